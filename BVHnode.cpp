@@ -1,146 +1,1101 @@
 #include "BVHnode.h"
 
- BVHnode::BVHnode(const std::vector<Vec3i>& connectivity, const AABB& aabb, const Mesh& mod, int meshIndex)
+namespace
 {
-    //std::cout << "size : " << connectivity.size() << std::endl;
-    // Stop condition
-    if (connectivity.size() <= 1)
+    // Minimum number of primitives handled by one chunk of a parallel loop
+    const int kMinChunkSize = 8192;
+
+    // Number of chunks a range of primitives is split into, 1 when the loop should stay serial
+    int chunkCount(int count, bool parallel)
+    {
+        if (!parallel || !omp_in_parallel()) return 1;
+        return std::max(1, std::min(4 * omp_get_num_threads(), count / kMinChunkSize));
+    }
+
+    // Run body(chunk, chunkBegin, chunkEnd) on each chunk of [begin, end) as OpenMP tasks
+    template <typename Body>
+    void forEachChunk(int begin, int end, int chunks, const Body& body)
+    {
+        if (chunks <= 1)
+        {
+            body(0, begin, end);
+            return;
+        }
+        for (int c = 0; c < chunks; c++)
+        {
+            int chunkBegin = begin + int(int64_t(end - begin) * c / chunks);
+            int chunkEnd = begin + int(int64_t(end - begin) * (c + 1) / chunks);
+            #pragma omp task firstprivate(c, chunkBegin, chunkEnd) shared(body)
+            body(c, chunkBegin, chunkEnd);
+        }
+        #pragma omp taskwait
+    }
+}
+
+BVHbuilder::BVHbuilder(const BVHBuildParams& params, const std::vector<AABB>& primitiveBoxes) : m_params(params), m_boxes(primitiveBoxes)
+{
+    m_params.maxLeafSize = std::max(1, std::min(params.maxLeafSize, int(std::numeric_limits<uint16_t>::max())));
+    m_params.binCount = std::max(2, params.binCount);
+    m_params.taskThreshold = std::max(m_params.maxLeafSize + 1, params.taskThreshold);
+}
+
+void BVHbuilder::build(std::vector<BVHnode>& nodes)
+{
+    nodes.clear();
+    if (m_boxes.size() == 0) return;
+    // Join the enclosing team when called from a task (e.g. from BVHroot), otherwise start one
+    if (omp_in_parallel() || !m_params.parallel)
     {
-        m_connectivity = connectivity;
-        m_aabb = aabb;
-        m_meshIndex = meshIndex;
+        buildRoot(nodes);
     }
     else
     {
-        m_connectivity = connectivity;
-        m_aabb = aabb;
-        m_meshIndex = meshIndex;
+        #pragma omp parallel
+        #pragma omp single
+        buildRoot(nodes);
+    }
+}
+
+void BVHbuilder::buildRoot(std::vector<BVHnode>& nodes)
+{
+    // Precompute centroids once, the build only moves indices around
+    int count = int(m_boxes.size());
+    m_centroids.resize(count);
+    m_order.resize(count);
+    forEachChunk(0, count, chunkCount(count, m_params.parallel), [&](int, int chunkBegin, int chunkEnd)
+    {
+        for (int i = chunkBegin; i < chunkEnd; i++)
+        {
+            m_centroids[i] = (m_boxes[i].min() + m_boxes[i].max()) * 0.5f;
+            m_order[i] = i;
+        }
+    });
+    nodes.reserve(2 * count / m_params.maxLeafSize + 1);
+    build(nodes, 0, count, 0);
+}
+
+void BVHbuilder::computeBounds(int begin, int end, AABB& aabb, AABB& centroidBox) const
+{
+    int chunks = chunkCount(end - begin, m_params.parallel);
+    std::vector<AABB> boxes(chunks), centroidBoxes(chunks);
+    forEachChunk(begin, end, chunks, [&](int chunk, int chunkBegin, int chunkEnd)
+    {
+        for (int i = chunkBegin; i < chunkEnd; i++)
+        {
+            boxes[chunk].compareAndUpdate(m_boxes[m_order[i]]);
+            centroidBoxes[chunk].compareAndUpdate(m_centroids[m_order[i]]);
+        }
+    });
+    aabb = AABB(); centroidBox = AABB();
+    for (int c = 0; c < chunks; c++)
+    {
+        aabb.compareAndUpdate(boxes[c]);
+        centroidBox.compareAndUpdate(centroidBoxes[c]);
+    }
+}
+
+int BVHbuilder::build(std::vector<BVHnode>& nodes, int begin, int end, int depth)
+{
+    int nodeIndex = int(nodes.size());
+    nodes.push_back(BVHnode());
+    AABB aabb{}, centroidBox{};
+    computeBounds(begin, end, aabb, centroidBox);
+    nodes[nodeIndex].m_aabb = aabb;
+    int count = end - begin;
+    int dimension = 0;
+    int mid = -1;
+    if (m_params.splitMethod == BVHBuildParams::SAH && depth < kMaxSAHDepth && count > 1)
+    {
+        mid = findSAHSplit(begin, end, aabb, centroidBox, dimension);
+        // Stop condition : splitting costs more than intersecting all primitives
+        if (mid < 0 && count <= m_params.maxLeafSize)
+        {
+            mid = begin;
+        }
+    }
+    else if (count <= m_params.maxLeafSize)
+    {
+        mid = begin;
+    }
+    if (mid == begin)
+    {
+        nodes[nodeIndex].m_offset = begin;
+        nodes[nodeIndex].m_nTriangles = uint16_t(count);
+        return nodeIndex;
+    }
+    if (mid < 0)
+    {
         //determine in which dimension to split 
-        Vec3f diff = aabb.max() - aabb.min();
-        int dimension = -1;
-        if (diff[0] >= std::max(diff[1], diff[2])) dimension = 0;
-        else if (diff[1] >= std::max(diff[0], diff[2])) dimension = 1;
-        else if (diff[2] >= std::max(diff[1], diff[0])) dimension = 2;
-        std::vector<float> barycenters;
-        //compute triangle barycenter
-        for (int i = 0; i < connectivity.size(); i++)
-        {
-            const Vec3f& pt0 = mod.vertices()[connectivity[i][0]];
-            const Vec3f& pt1 = mod.vertices()[connectivity[i][1]];
-            const Vec3f& pt2 = mod.vertices()[connectivity[i][2]];
-            Vec3f bar = (pt0 + pt1 + pt2) / 3.f;
-            barycenters.push_back(bar[dimension]);
-        }
-        std::sort(barycenters.begin(), barycenters.end());
-        float median = barycenters[barycenters.size() / 2];
-        //sort triangles in two subsets
-        std::vector<Vec3i> connectivityLeft, connectivityRight;
-        const Vec3f& init = mod.vertices()[connectivity[0][0]];
-        Vec3f minRight = init, minLeft = init, maxRight = init, maxLeft = init;
-        bool addLeft = false;
-        for (int i = 0; i < connectivity.size(); i++)
-        {
-            const Vec3f& pt0 = mod.vertices()[connectivity[i][0]];
-            const Vec3f& pt1 = mod.vertices()[connectivity[i][1]];
-            const Vec3f& pt2 = mod.vertices()[connectivity[i][2]];
-            Vec3f bar = (pt0 + pt1 + pt2) / 3.f;
-            if (bar[dimension] == median)
+        Vec3f diff = centroidBox.max() - centroidBox.min();
+        dimension = 0;
+        if (diff[1] > diff[dimension]) dimension = 1;
+        if (diff[2] > diff[dimension]) dimension = 2;
+        //split on the median centroid
+        mid = (begin + end) / 2;
+        const std::vector<Vec3f>& centroids = m_centroids;
+        std::nth_element(m_order.begin() + begin, m_order.begin() + mid, m_order.begin() + end,
+            [&](int a, int b) { return centroids[a][dimension] < centroids[b][dimension]; });
+    }
+    nodes[nodeIndex].m_axis = uint8_t(dimension);
+    if (!m_params.parallel || !omp_in_parallel() || std::min(mid - begin, end - mid) < m_params.taskThreshold)
+    {
+        build(nodes, begin, mid, depth + 1);
+        nodes[nodeIndex].m_offset = build(nodes, mid, end, depth + 1);
+        return nodeIndex;
+    }
+    // Large subtrees : the second child is built by another task in its own node array while this
+    // task builds the first one in place, then it is appended to keep the depth-first layout.
+    // Both tasks work on disjoint ranges of m_order.
+    std::vector<BVHnode> rightNodes;
+    #pragma omp task shared(rightNodes)
+    build(rightNodes, mid, end, depth + 1);
+    build(nodes, begin, mid, depth + 1);
+    #pragma omp taskwait
+    int rightOffset = int(nodes.size());
+    nodes[nodeIndex].m_offset = rightOffset;
+    for (int i = 0; i < int(rightNodes.size()); i++)
+    {
+        // Leaves reference primitives, only child indices are local to rightNodes
+        if (!rightNodes[i].isLeaf()) rightNodes[i].m_offset += rightOffset;
+    }
+    nodes.insert(nodes.end(), rightNodes.begin(), rightNodes.end());
+    return nodeIndex;
+}
+
+// Bin centroids along each axis and partition the range on the cheapest bin boundary.
+// Returns the partition index, or -1 if no split is cheaper than making a leaf.
+int BVHbuilder::findSAHSplit(int begin, int end, const AABB& aabb, const AABB& centroidBox, int& dimension)
+{
+    const BVHBuildParams& params = m_params;
+    const int binCount = params.binCount;
+    std::vector<AABB> binBoxes(binCount), rightBoxes(binCount);
+    std::vector<int> binCounts(binCount);
+    float bestCost = std::numeric_limits<float>::max();
+    int bestAxis = -1, bestBin = -1;
+    // Bin the three axes at once, chunks of large ranges are binned by separate tasks
+    int chunks = chunkCount(end - begin, m_params.parallel);
+    std::vector<AABB> chunkBoxes(chunks * 3 * binCount);
+    std::vector<int> chunkCounts(chunks * 3 * binCount, 0);
+    Vec3f minC = centroidBox.min();
+    Vec3f scale;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float extent = centroidBox.max()[axis] - minC[axis];
+        scale[axis] = extent > 0.f ? binCount / extent : 0.f;
+    }
+    forEachChunk(begin, end, chunks, [&](int chunk, int chunkBegin, int chunkEnd)
+    {
+        AABB* boxes = &chunkBoxes[chunk * 3 * binCount];
+        int* counts = &chunkCounts[chunk * 3 * binCount];
+        for (int i = chunkBegin; i < chunkEnd; i++)
+        {
+            int primitive = m_order[i];
+            for (int axis = 0; axis < 3; axis++)
             {
-                if (addLeft) {
-                    connectivityLeft.push_back(connectivity[i]);
-                    for (int j = 0; j < 3; j++)
-                    {
-                        minLeft[j] = std::min(minLeft[j], std::min(pt2[j], std::min(pt0[j], pt1[j])));
-                        maxLeft[j] = std::max(maxLeft[j], std::max(pt2[j], std::max(pt0[j], pt1[j])));
-                    }
-                }
-                else {
-                    connectivityRight.push_back(connectivity[i]);
-                    for (int j = 0; j < 3; j++)
-                    {
-                        minRight[j] = std::min(minRight[j], std::min(pt2[j], std::min(pt0[j], pt1[j])));
-                        maxRight[j] = std::max(maxRight[j], std::max(pt2[j], std::max(pt0[j], pt1[j])));
-                    }
-                }
-                addLeft = !addLeft;
+                int bin = axis * binCount + std::min(binCount - 1, int((m_centroids[primitive][axis] - minC[axis]) * scale[axis]));
+                counts[bin]++;
+                boxes[bin].compareAndUpdate(m_boxes[primitive]);
+            }
+        }
+    });
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (scale[axis] <= 0.f) continue;
+        // Merge the chunk bins
+        std::fill(binBoxes.begin(), binBoxes.end(), AABB());
+        std::fill(binCounts.begin(), binCounts.end(), 0);
+        for (int c = 0; c < chunks; c++)
+        {
+            for (int b = 0; b < binCount; b++)
+            {
+                binBoxes[b].compareAndUpdate(chunkBoxes[(c * 3 + axis) * binCount + b]);
+                binCounts[b] += chunkCounts[(c * 3 + axis) * binCount + b];
             }
-            else if (bar[dimension] < median)
+        }
+        // Sweep from the right to get the bounds of every right side
+        AABB rightBox{};
+        for (int b = binCount - 1; b > 0; b--)
+        {
+            rightBox.compareAndUpdate(binBoxes[b]);
+            rightBoxes[b] = rightBox;
+        }
+        // Sweep from the left and evaluate the split after each bin
+        AABB leftBox{};
+        int leftCount = 0;
+        for (int b = 0; b < binCount - 1; b++)
+        {
+            leftBox.compareAndUpdate(binBoxes[b]);
+            leftCount += binCounts[b];
+            int rightCount = (end - begin) - leftCount;
+            if (leftCount == 0 || rightCount == 0) continue;
+            float cost = leftCount * leftBox.surfaceArea() + rightCount * rightBoxes[b + 1].surfaceArea();
+            if (cost < bestCost)
             {
-                connectivityLeft.push_back(connectivity[i]);
-                for (int j = 0; j < 3; j++)
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = b;
+            }
+        }
+    }
+    if (bestAxis < 0) return -1;
+    float splitCost = params.traversalCost + params.intersectionCost * bestCost / aabb.surfaceArea();
+    float leafCost = params.intersectionCost * (end - begin);
+    if (splitCost >= leafCost && end - begin <= params.maxLeafSize) return -1;
+    // Partition the range on the chosen bin boundary
+    dimension = bestAxis;
+    const std::vector<Vec3f>& centroids = m_centroids;
+    std::vector<int>::iterator midIt = std::partition(m_order.begin() + begin, m_order.begin() + end,
+        [&](int primitive) { return std::min(binCount - 1, int((centroids[primitive][bestAxis] - minC[bestAxis]) * scale[bestAxis])) <= bestBin; });
+    return int(midIt - m_order.begin());
+}
+
+BVH::BVH(const Mesh& mesh, int meshIndex, const BVHBuildParams& params) : m_meshIndex(meshIndex)
+{
+    const std::vector<Vec3i>& indices = mesh.indices();
+    if (indices.size() == 0) return;
+    int count = int(indices.size());
+    std::vector<AABB> triangleBoxes(count);
+    forEachChunk(0, count, chunkCount(count, params.parallel), [&](int, int chunkBegin, int chunkEnd)
+    {
+        for (int i = chunkBegin; i < chunkEnd; i++)
+        {
+            const Vec3<Vec3f>& tri = mesh.triangle(indices[i]);
+            for (int k = 0; k < 3; k++) triangleBoxes[i].compareAndUpdate(tri[k]);
+        }
+    });
+    BVHbuilder builder(params, triangleBoxes);
+    builder.build(m_nodes);
+    // Single triangle array, reordered so that each leaf references a contiguous range
+    // starting on a block boundary and padded to whole blocks
+    const std::vector<int>& order = builder.order();
+    m_triangles.reserve(indices.size() + (kTriangleBlockSize - 1) * m_nodes.size() / 2);
+    m_triangleIds.reserve(m_triangles.capacity());
+    for (int n = 0; n < int(m_nodes.size()); n++)
+    {
+        BVHnode& node = m_nodes[n];
+        if (!node.isLeaf()) continue;
+        int leafBegin = int(m_triangles.size());
+        for (int i = node.m_offset; i < node.m_offset + node.m_nTriangles; i++)
+        {
+            m_triangles.push_back(indices[order[i]]);
+            m_triangleIds.push_back(order[i]);
+        }
+        int blockCount = (node.m_nTriangles + kTriangleBlockSize - 1) / kTriangleBlockSize;
+        m_triangles.resize(leafBegin + blockCount * kTriangleBlockSize, Vec3i(-1, -1, -1));
+        m_triangleIds.resize(m_triangles.size(), -1);
+        node.m_offset = leafBegin;
+    }
+    // Gather the vertices of each block once, so that leaves don't go through the mesh index buffer
+    int blockCount = int(m_triangles.size()) / kTriangleBlockSize;
+    m_blocks.resize(blockCount);
+    forEachChunk(0, blockCount, chunkCount(blockCount, params.parallel), [&](int, int chunkBegin, int chunkEnd)
+    {
+        for (int b = chunkBegin; b < chunkEnd; b++)
+        {
+            TriangleBlock block{};
+            for (int lane = 0; lane < kTriangleBlockSize; lane++)
+            {
+                const Vec3i& triangle = m_triangles[b * kTriangleBlockSize + lane];
+                if (triangle[0] < 0) continue;
+                const Vec3<Vec3f>& tri = mesh.triangle(triangle);
+                Vec3f edge1 = tri[1] - tri[0];
+                Vec3f edge2 = tri[2] - tri[0];
+                for (int axis = 0; axis < 3; axis++)
                 {
-                    minLeft[j] = std::min(minLeft[j], std::min(pt2[j], std::min(pt0[j], pt1[j])));
-                    maxLeft[j] = std::max(maxLeft[j], std::max(pt2[j], std::max(pt0[j], pt1[j])));
+                    block.m_v0[axis][lane] = tri[0][axis];
+                    block.m_edge1[axis][lane] = edge1[axis];
+                    block.m_edge2[axis][lane] = edge2[axis];
                 }
             }
-            else
+            m_blocks[b] = block;
+        }
+    });
+    m_aabb = m_nodes[0].m_aabb;
+    // Wide layouts are collapsed from the binary tree
+    m_width = params.width;
+    m_watertight = params.watertight;
+    if (m_width == 4) collapse(m_nodes4);
+    else if (m_width == 8) collapse(m_nodes8);
+    else m_width = 2;
+}
+
+float BVH::sahCost(const BVHBuildParams& params) const
+{
+    if (m_nodes.size() == 0) return 0.f;
+    float rootArea = m_nodes[0].m_aabb.surfaceArea();
+    float cost = 0.f;
+    for (int i = 0; i < int(m_nodes.size()); i++)
+    {
+        const BVHnode& node = m_nodes[i];
+        float probability = rootArea > 0.f ? node.m_aabb.surfaceArea() / rootArea : 1.f;
+        cost += probability * (node.isLeaf() ? params.intersectionCost * node.m_nTriangles : params.traversalCost);
+    }
+    return cost;
+}
+
+bool BVH::hit(const Ray& ray, hitInfo& hitRecord, const std::vector<Mesh>& meshes) const
+{
+    return traverse<false>(ray, hitRecord, meshes);
+}
+
+bool BVH::occluded(const Ray& ray, const std::vector<Mesh>& meshes) const
+{
+    hitInfo hitRecord{};
+    hitRecord.parT = ray.m_tMax;
+    return traverse<true>(ray, hitRecord, meshes);
+}
+
+template <bool AnyHit>
+bool BVH::traverse(const Ray& ray, hitInfo& hitRecord, const std::vector<Mesh>& meshes) const
+{
+    if (m_nodes.size() == 0) return false;
+    const Mesh& mesh = meshes[m_meshIndex];
+    // Boxes and triangle blocks are tested in build space, which keeps the parametric distance and interval of the world ray
+    // Only moved meshes pay for a transformed copy of the ray
+    Ray transformed;
+    if (m_transformed) transformed = Ray((ray.m_origin - m_translation) / m_scale, ray.m_direction / m_scale, ray.m_tMin, ray.m_tMax);
+    const Ray& boxRay = m_transformed ? transformed : ray;
+    if (m_width == 4) return traverseWide<4, AnyHit>(m_nodes4, ray, boxRay, mesh, hitRecord);
+    if (m_width == 8) return traverseWide<8, AnyHit>(m_nodes8, ray, boxRay, mesh, hitRecord);
+    // The nearest child is the first one unless the ray goes backwards along the split axis
+    bool intersect = false;
+    int stack[kStackSize];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        int nodeIndex = stack[--stackSize];
+        const BVHnode& node = m_nodes[nodeIndex];
+        float tmin, tmax;
+        // Cull the subtree if it is missed or entered beyond the closest hit so far
+        if (!node.m_aabb.hit(boxRay, tmin, tmax) || tmin > hitRecord.parT) continue;
+        if (node.isLeaf())
+        {
+            bool leafHit = m_watertight ? intersectLeafWatertight<AnyHit>(ray, mesh, node.m_offset, node.m_nTriangles, hitRecord)
+                                        : intersectLeaf<AnyHit>(boxRay, node.m_offset, node.m_nTriangles, hitRecord);
+            if (leafHit)
+            {
+                if (AnyHit) return true;
+                intersect = true;
+            }
+        }
+        else if (boxRay.m_sign[node.m_axis])
+        {
+            stack[stackSize++] = nodeIndex + 1;
+            stack[stackSize++] = node.m_offset;
+        }
+        else
+        {
+            stack[stackSize++] = node.m_offset;
+            stack[stackSize++] = nodeIndex + 1;
+        }
+    }
+    return intersect;
+}
+
+namespace
+{
+    // Same thresholds as Ray::testTriangleIntersection
+    const float kTriangleEpsilon = 0.000001f;
+
+    // Moller-Trumbore test of one ray against the triangles of a block. Returns the mask of lanes hit
+    // in [tMin, tMax[ and writes their distance and the first two barycentric coordinates.
+    inline int intersectBlock(const TriangleBlock& block, const Ray& ray, float tMin, float tMax, float t[kTriangleBlockSize], float b0[kTriangleBlockSize], float b1[kTriangleBlockSize])
+    {
+        const Vec3fa& o = ray.m_origin;
+        const Vec3fa& d = ray.m_direction;
+        int mask = 0;
+        for (int lane = 0; lane < kTriangleBlockSize; lane++)
+        {
+            Vec3fa v0(block.m_v0[0][lane], block.m_v0[1][lane], block.m_v0[2][lane]);
+            Vec3fa e1(block.m_edge1[0][lane], block.m_edge1[1][lane], block.m_edge1[2][lane]);
+            Vec3fa e2(block.m_edge2[0][lane], block.m_edge2[1][lane], block.m_edge2[2][lane]);
+            Vec3fa q = cross(d, e2);
+            float a = dot(e1, q);
+            if (std::abs(a) < kTriangleEpsilon) continue;
+            float invA = 1.f / a;
+            Vec3fa s = o - v0;
+            Vec3fa r = cross(s, e1);
+            b0[lane] = dot(s, q) * invA;
+            b1[lane] = dot(r, d) * invA;
+            t[lane] = dot(e2, r) * invA;
+            if (b0[lane] >= 0.f && b1[lane] >= 0.f && b0[lane] + b1[lane] <= 1.f && t[lane] > kTriangleEpsilon && t[lane] >= tMin && t[lane] < tMax) mask |= 1 << lane;
+        }
+        return mask;
+    }
+
+#if defined(SIMD_AVX)
+    inline int intersectBlock8(const TriangleBlock& block, const Ray& ray, float tMin, float tMax, float t[8], float b0[8], float b1[8])
+    {
+        Vec3x8 o(ray.m_origin), d(ray.m_direction);
+        Vec3x8 e1 = Vec3x8::load(block.m_edge1), e2 = Vec3x8::load(block.m_edge2);
+        Vec3x8 q = cross(d, e2);
+        Float8 a = dot(e1, q);
+        Float8 invA = Float8(1.f) / a;
+        Vec3x8 s = o - Vec3x8::load(block.m_v0);
+        Vec3x8 r = cross(s, e1);
+        Float8 u = dot(s, q) * invA;
+        Float8 v = dot(r, d) * invA;
+        Float8 dist = dot(e2, r) * invA;
+        // Ordered comparisons are false for the NaNs of empty lanes
+        Bool8 valid = (abs(a) >= kTriangleEpsilon) & (u >= 0.f) & (v >= 0.f) & (u + v <= 1.f);
+        valid = valid & (dist >= std::max(tMin, kTriangleEpsilon)) & (dist < tMax);
+        int mask = movemask(valid);
+        if (mask)
+        {
+            dist.store(t);
+            u.store(b0);
+            v.store(b1);
+        }
+        return mask;
+    }
+#elif defined(SIMD_SSE)
+    inline int intersectBlock4(const TriangleBlock& block, const Ray& ray, float tMin, float tMax, float t[4], float b0[4], float b1[4])
+    {
+        __m128 ox = _mm_set1_ps(ray.m_origin[0]), oy = _mm_set1_ps(ray.m_origin[1]), oz = _mm_set1_ps(ray.m_origin[2]);
+        __m128 dx = _mm_set1_ps(ray.m_direction[0]), dy = _mm_set1_ps(ray.m_direction[1]), dz = _mm_set1_ps(ray.m_direction[2]);
+        __m128 e1x = _mm_loadu_ps(block.m_edge1[0]), e1y = _mm_loadu_ps(block.m_edge1[1]), e1z = _mm_loadu_ps(block.m_edge1[2]);
+        __m128 e2x = _mm_loadu_ps(block.m_edge2[0]), e2y = _mm_loadu_ps(block.m_edge2[1]), e2z = _mm_loadu_ps(block.m_edge2[2]);
+        // q = d x e2, a = e1.q
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, qx), _mm_mul_ps(e1y, qy)), _mm_mul_ps(e1z, qz));
+        __m128 invA = _mm_div_ps(_mm_set1_ps(1.f), a);
+        // s = o - v0, r = s x e1
+        __m128 sx = _mm_sub_ps(ox, _mm_loadu_ps(block.m_v0[0]));
+        __m128 sy = _mm_sub_ps(oy, _mm_loadu_ps(block.m_v0[1]));
+        __m128 sz = _mm_sub_ps(oz, _mm_loadu_ps(block.m_v0[2]));
+        __m128 rx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+        __m128 ry = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+        __m128 rz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, qx), _mm_mul_ps(sy, qy)), _mm_mul_ps(sz, qz)), invA);
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, dx), _mm_mul_ps(ry, dy)), _mm_mul_ps(rz, dz)), invA);
+        __m128 dist = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, rx), _mm_mul_ps(e2y, ry)), _mm_mul_ps(e2z, rz)), invA);
+        // Ordered comparisons are false for the NaNs of empty lanes
+        __m128 zero = _mm_setzero_ps();
+        __m128 absA = _mm_andnot_ps(_mm_set1_ps(-0.f), a);
+        __m128 valid = _mm_cmpge_ps(absA, _mm_set1_ps(kTriangleEpsilon));
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+        valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.f)));
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(dist, _mm_set1_ps(std::max(tMin, kTriangleEpsilon))));
+        valid = _mm_and_ps(valid, _mm_cmplt_ps(dist, _mm_set1_ps(tMax)));
+        int mask = _mm_movemask_ps(valid);
+        if (mask)
+        {
+            _mm_storeu_ps(t, dist);
+            _mm_storeu_ps(b0, u);
+            _mm_storeu_ps(b1, v);
+        }
+        return mask;
+    }
+#endif
+}
+
+template <bool AnyHit>
+bool BVH::intersectLeaf(const Ray& boxRay, int offset, int count, hitInfo& hitRecord) const
+{
+    bool intersect = false;
+    int firstBlock = offset / kTriangleBlockSize;
+    int lastBlock = (offset + count - 1) / kTriangleBlockSize;
+    for (int b = firstBlock; b <= lastBlock; b++)
+    {
+        float t[kTriangleBlockSize], b0[kTriangleBlockSize], b1[kTriangleBlockSize];
+        float tMax = std::min(hitRecord.parT, boxRay.m_tMax);
+#if defined(SIMD_AVX)
+        int mask = intersectBlock8(m_blocks[b], boxRay, boxRay.m_tMin, tMax, t, b0, b1);
+#elif defined(SIMD_SSE)
+        int mask = intersectBlock4(m_blocks[b], boxRay, boxRay.m_tMin, tMax, t, b0, b1);
+#else
+        int mask = intersectBlock(m_blocks[b], boxRay, boxRay.m_tMin, tMax, t, b0, b1);
+#endif
+        if (mask == 0) continue;
+        if (AnyHit) return true;
+        // Keep the closest lane
+        int closest = -1;
+        for (int lane = 0; lane < kTriangleBlockSize; lane++)
+        {
+            if ((mask & (1 << lane)) && (closest < 0 || t[lane] < t[closest])) closest = lane;
+        }
+        hitRecord.barCoord = Vec3f(b0[closest], b1[closest], 1.f - b0[closest] - b1[closest]);
+        hitRecord.parT = t[closest];
+        hitRecord.meshIndex = m_meshIndex;
+        hitRecord.triangleIndices = m_triangles[b * kTriangleBlockSize + closest];
+        hitRecord.triangle = m_triangleIds[b * kTriangleBlockSize + closest];
+        intersect = true;
+    }
+    return intersect;
+}
+
+// Vertices shared by neighbouring triangles have to be bit identical for the watertight test, so it goes through
+// the current mesh vertices with the world ray rather than through the blocks
+template <bool AnyHit>
+bool BVH::intersectLeafWatertight(const Ray& ray, const Mesh& mesh, int offset, int count, hitInfo& hitRecord) const
+{
+    bool intersect = false;
+    for (int i = offset; i < offset + count; i++)
+    {
+        float t; Vec3f barCoord;
+        bool triangleIntersect = ray.testTriangleIntersectionWatertight(mesh.triangle(m_triangles[i]), barCoord, t);
+        if (triangleIntersect && t < hitRecord.parT)
+        {
+            if (AnyHit) return true;
+            hitRecord.barCoord = barCoord;
+            hitRecord.parT = t;
+            hitRecord.meshIndex = m_meshIndex;
+            hitRecord.triangleIndices = m_triangles[i];
+            hitRecord.triangle = m_triangleIds[i];
+            intersect = true;
+        }
+    }
+    return intersect;
+}
+
+template <int N>
+void BVH::collapse(std::vector<WideBVHnode<N>>& wideNodes) const
+{
+    wideNodes.clear();
+    wideNodes.reserve(m_nodes.size() / (N - 1) + 1);
+    collapseNode(wideNodes, 0);
+}
+
+// Gather up to N descendants of a binary node by repeatedly opening the interior candidate with the
+// largest surface area, then collapse the interior ones recursively
+template <int N>
+int BVH::collapseNode(std::vector<WideBVHnode<N>>& wideNodes, int nodeIndex) const
+{
+    int wideIndex = int(wideNodes.size());
+    wideNodes.push_back(WideBVHnode<N>());
+    int candidates[N];
+    int count = 0;
+    const BVHnode& node = m_nodes[nodeIndex];
+    if (node.isLeaf())
+    {
+        candidates[count++] = nodeIndex;
+    }
+    else
+    {
+        candidates[count++] = nodeIndex + 1;
+        candidates[count++] = node.m_offset;
+    }
+    while (count < N)
+    {
+        int best = -1;
+        float bestArea = -1.f;
+        for (int c = 0; c < count; c++)
+        {
+            const BVHnode& candidate = m_nodes[candidates[c]];
+            if (!candidate.isLeaf() && candidate.m_aabb.surfaceArea() > bestArea)
+            {
+                bestArea = candidate.m_aabb.surfaceArea();
+                best = c;
+            }
+        }
+        if (best < 0) break;
+        int opened = candidates[best];
+        candidates[best] = opened + 1;
+        candidates[count++] = m_nodes[opened].m_offset;
+    }
+    WideBVHnode<N> wideNode;
+    for (int c = 0; c < N; c++)
+    {
+        // Empty slots get an empty box that no ray can hit
+        AABB aabb = c < count ? m_nodes[candidates[c]].m_aabb : AABB();
+        for (int axis = 0; axis < 3; axis++)
+        {
+            wideNode.m_bounds[0][axis][c] = aabb.min()[axis];
+            wideNode.m_bounds[1][axis][c] = aabb.max()[axis];
+        }
+        wideNode.m_child[c] = -1;
+        wideNode.m_nTriangles[c] = 0;
+        if (c >= count) continue;
+        const BVHnode& child = m_nodes[candidates[c]];
+        if (child.isLeaf())
+        {
+            wideNode.m_child[c] = child.m_offset;
+            wideNode.m_nTriangles[c] = child.m_nTriangles;
+        }
+        else
+        {
+            wideNode.m_child[c] = collapseNode(wideNodes, candidates[c]);
+        }
+    }
+    wideNodes[wideIndex] = wideNode;
+    return wideIndex;
+}
+
+namespace
+{
+    // Slab test of one ray against the N children of a wide node. Returns the mask of children hit
+    // within [tMin, tMax] and writes their entry distances. neg[axis] selects the near plane from the ray direction sign,
+    // so that empty boxes (min > max) are always missed.
+    template <int N>
+    inline int intersectChildren(const WideBVHnode<N>& node, const float origin[3], const float invDir[3], const uint8_t neg[3], float tMin, float tMax, float tEntry[N])
+    {
+        int mask = 0;
+        for (int c = 0; c < N; c++)
+        {
+            float tNear = tMin, tFar = tMax;
+            for (int axis = 0; axis < 3; axis++)
             {
-                connectivityRight.push_back(connectivity[i]);
-                for (int j = 0; j < 3; j++)
+                tNear = std::max(tNear, (node.m_bounds[neg[axis]][axis][c] - origin[axis]) * invDir[axis]);
+                tFar = std::min(tFar, (node.m_bounds[1 - neg[axis]][axis][c] - origin[axis]) * invDir[axis]);
+            }
+            tEntry[c] = tNear;
+            if (tNear <= tFar) mask |= 1 << c;
+        }
+        return mask;
+    }
+
+#ifdef SIMD_SSE
+    template <>
+    inline int intersectChildren<4>(const WideBVHnode<4>& node, const float origin[3], const float invDir[3], const uint8_t neg[3], float tMin, float tMax, float tEntry[4])
+    {
+        __m128 tNear = _mm_set1_ps(tMin);
+        __m128 tFar = _mm_set1_ps(tMax);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            __m128 o = _mm_set1_ps(origin[axis]);
+            __m128 invD = _mm_set1_ps(invDir[axis]);
+            // NaN slabs (0 * inf) return the second operand and are ignored
+            tNear = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.m_bounds[neg[axis]][axis]), o), invD), tNear);
+            tFar = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.m_bounds[1 - neg[axis]][axis]), o), invD), tFar);
+        }
+        _mm_storeu_ps(tEntry, tNear);
+        return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+    }
+#endif
+
+#ifdef SIMD_AVX
+    template <>
+    inline int intersectChildren<8>(const WideBVHnode<8>& node, const float origin[3], const float invDir[3], const uint8_t neg[3], float tMin, float tMax, float tEntry[8])
+    {
+        __m256 tNear = _mm256_set1_ps(tMin);
+        __m256 tFar = _mm256_set1_ps(tMax);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            __m256 o = _mm256_set1_ps(origin[axis]);
+            __m256 invD = _mm256_set1_ps(invDir[axis]);
+            tNear = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.m_bounds[neg[axis]][axis]), o), invD), tNear);
+            tFar = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.m_bounds[1 - neg[axis]][axis]), o), invD), tFar);
+        }
+        _mm256_storeu_ps(tEntry, tNear);
+        return _mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+    }
+#endif
+}
+
+template <int N, bool AnyHit>
+bool BVH::traverseWide(const std::vector<WideBVHnode<N>>& wideNodes, const Ray& ray, const Ray& boxRay, const Mesh& mesh, hitInfo& hitRecord) const
+{
+    float origin[3], invDir[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        origin[axis] = boxRay.m_origin[axis];
+        invDir[axis] = boxRay.m_invDirection[axis];
+    }
+    // Interior children have no triangles, leaves are intersected when popped
+    struct StackEntry {
+        int32_t child;
+        int32_t nTriangles;
+        float t;
+    };
+    StackEntry stack[kStackSize * (N - 1) + 1];
+    int stackSize = 0;
+    stack[stackSize++] = { 0, 0, 0.f };
+    bool intersect = false;
+    while (stackSize > 0)
+    {
+        StackEntry entry = stack[--stackSize];
+        if (entry.t > hitRecord.parT) continue;
+        if (entry.nTriangles > 0)
+        {
+            bool leafHit = m_watertight ? intersectLeafWatertight<AnyHit>(ray, mesh, entry.child, entry.nTriangles, hitRecord)
+                                        : intersectLeaf<AnyHit>(boxRay, entry.child, entry.nTriangles, hitRecord);
+            if (leafHit)
+            {
+                if (AnyHit) return true;
+                intersect = true;
+            }
+            continue;
+        }
+        const WideBVHnode<N>& node = wideNodes[entry.child];
+        float tEntry[N];
+        int mask = intersectChildren<N>(node, origin, invDir, boxRay.m_sign, boxRay.m_tMin, hitRecord.parT, tEntry);
+        // Insert the children hit sorted by decreasing entry distance so that the nearest is popped first
+        int first = stackSize;
+        for (int c = 0; c < N; c++)
+        {
+            if (!(mask & (1 << c))) continue;
+            StackEntry childEntry = { node.m_child[c], node.m_nTriangles[c], tEntry[c] };
+            int k = stackSize++;
+            while (k > first && stack[k - 1].t < childEntry.t)
+            {
+                stack[k] = stack[k - 1];
+                k--;
+            }
+            stack[k] = childEntry;
+        }
+    }
+    return intersect;
+}
+
+namespace
+{
+    // Conservative bounds of the slab test of a packet : interval arithmetic over the ranges of origins and inverse
+    // directions. Only valid when all the rays go the same way along each axis, otherwise m_coherent is false.
+    struct PacketFrustum {
+        float m_originMin[3], m_originMax[3];
+        float m_invDirMin[3], m_invDirMax[3];
+        int m_sign[3];
+        bool m_coherent = true;
+
+        PacketFrustum(const Ray* rays, int count)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                m_sign[axis] = rays[0].m_sign[axis];
+                m_originMin[axis] = m_originMax[axis] = rays[0].m_origin[axis];
+                m_invDirMin[axis] = m_invDirMax[axis] = rays[0].m_invDirection[axis];
+            }
+            for (int r = 0; r < count; r++)
+            {
+                for (int axis = 0; axis < 3; axis++)
                 {
-                    minRight[j] = std::min(minRight[j], std::min(pt2[j], std::min(pt0[j], pt1[j])));
-                    maxRight[j] = std::max(maxRight[j], std::max(pt2[j], std::max(pt0[j], pt1[j])));
+                    const Ray& ray = rays[r];
+                    if (ray.m_sign[axis] != m_sign[axis] || !std::isfinite(ray.m_invDirection[axis])) m_coherent = false;
+                    m_originMin[axis] = std::min(m_originMin[axis], ray.m_origin[axis]);
+                    m_originMax[axis] = std::max(m_originMax[axis], ray.m_origin[axis]);
+                    m_invDirMin[axis] = std::min(m_invDirMin[axis], ray.m_invDirection[axis]);
+                    m_invDirMax[axis] = std::max(m_invDirMax[axis], ray.m_invDirection[axis]);
                 }
             }
         }
-        //compute AABB
-        AABB aabbLeft(minLeft, maxLeft), aabbRight(minRight, maxRight);        
-        m_left = BVHptr(new BVHnode(connectivityLeft, aabbLeft, mod, meshIndex)); 
-        m_right = BVHptr(new BVHnode(connectivityRight, aabbRight, mod, meshIndex));
-    }    
-}
-
- bool BVHnode::hit(const Ray& ray, hitInfo& hitRecord, const std::vector<Mesh>& meshes)
- {
-     float tmin, tmax;
-     //the root has no defined bounding box and its meshIndex is = to -1     
-     if (m_aabb.hit(ray, tmin, tmax) || m_connectivity.size()==0)
-     {   
-         //Stop condition : node is leaf
-         if (m_connectivity.size() <= 8)
-         {                          
-             bool test = false;
-             for (int i = 0; i < m_connectivity.size(); i++)
-             {
-                 float t; Vec3f barCoord;
-                 bool triangleIntersect = ray.testTriangleIntersection(meshes[m_meshIndex].triangle(m_connectivity[i]), barCoord, t);
-                 if (triangleIntersect && t < hitRecord.parT)
-                 {                     
-                     hitRecord.barCoord = barCoord;
-                     hitRecord.parT = t;
-                     hitRecord.meshIndex = m_meshIndex;
-                     hitRecord.triangleIndices = m_connectivity[i];
-                     test = true;
-                 }
-             }
-             return test;
-         }
-         else
-         {             
-             hitInfo hitInfo1(hitRecord), hitInfo2(hitRecord);
-             bool hit1 = m_left->hit(ray, hitInfo1, meshes);
-             bool hit2 = m_right->hit(ray, hitInfo2, meshes);
-             if (hit1 && hit2)
-             {
-                 if (hitInfo1.parT < hitInfo2.parT)
-                 {
-                     hitRecord = hitInfo1;
-                     return hit1;
-                 }
-                 else
-                 {
-                     hitRecord = hitInfo2;
-                     return hit2;
-                 }
-             }
-             else if (hit1) { hitRecord = hitInfo1; return hit1; }
-             else if (hit2) { hitRecord = hitInfo2; return hit2; }
-             else 
-             { 
-                 //std::cout << "false" << std::endl;
-                 return false; 
-             }
-         }
-     }
-     else return false;
- }
+
+        // False when no ray of the packet can enter the box within [tMin, tMax]
+        inline bool hit(const AABB& box, float tMin, float tMax) const
+        {
+            const Vec3f corners[2] = { box.min(), box.max() };
+            for (int axis = 0; axis < 3; axis++)
+            {
+                float nearPlane = corners[m_sign[axis]][axis];
+                float farPlane = corners[1 - m_sign[axis]][axis];
+                // Lowest entry and highest exit distances over all origin / inverse direction combinations
+                float n0 = (nearPlane - m_originMin[axis]) * m_invDirMin[axis], n1 = (nearPlane - m_originMin[axis]) * m_invDirMax[axis];
+                float n2 = (nearPlane - m_originMax[axis]) * m_invDirMin[axis], n3 = (nearPlane - m_originMax[axis]) * m_invDirMax[axis];
+                float f0 = (farPlane - m_originMin[axis]) * m_invDirMin[axis], f1 = (farPlane - m_originMin[axis]) * m_invDirMax[axis];
+                float f2 = (farPlane - m_originMax[axis]) * m_invDirMin[axis], f3 = (farPlane - m_originMax[axis]) * m_invDirMax[axis];
+                tMin = std::max(tMin, std::min(std::min(n0, n1), std::min(n2, n3)));
+                tMax = std::min(tMax, std::max(std::max(f0, f1), std::max(f2, f3)));
+                if (tMax < tMin) return false;
+            }
+            return true;
+        }
+    };
+
+    // Largest distance at which a ray of the packet still looks for a hit, -1 when all of them are done
+    inline float packetMaxT(const Ray* rays, int count, const hitInfo* hitRecords, uint64_t doneMask, float& minT)
+    {
+        float maxT = -1.f;
+        minT = std::numeric_limits<float>::max();
+        for (int r = 0; r < count; r++)
+        {
+            if (doneMask & (uint64_t(1) << r)) continue;
+            maxT = std::max(maxT, std::min(hitRecords[r].parT, rays[r].m_tMax));
+            minT = std::min(minT, rays[r].m_tMin);
+        }
+        return maxT;
+    }
+}
+
+// Ranged packet traversal : each stack entry keeps the first ray of the packet that entered the node, so the rays
+// before it are never tested again in the subtree. A node is culled by the packet frustum before any ray is tested.
+template <bool AnyHit>
+void BVH::traversePacket(const Ray* rays, int count, hitInfo* hitRecords, uint64_t& hitMask, const std::vector<Mesh>& meshes) const
+{
+    if (m_nodes.size() == 0) return;
+    // Wide nodes have no packet traversal, their rays go one by one
+    if (m_width != 2)
+    {
+        for (int r = 0; r < count; r++)
+        {
+            if (AnyHit && (hitMask & (uint64_t(1) << r))) continue;
+            if (traverse<AnyHit>(rays[r], hitRecords[r], meshes)) hitMask |= uint64_t(1) << r;
+        }
+        return;
+    }
+    const Mesh& mesh = meshes[m_meshIndex];
+    Ray boxRays[kPacketSize];
+    for (int r = 0; r < count; r++)
+    {
+        boxRays[r] = m_transformed ? Ray((rays[r].m_origin - m_translation) / m_scale, rays[r].m_direction / m_scale, rays[r].m_tMin, rays[r].m_tMax) : rays[r];
+    }
+    PacketFrustum frustum(boxRays, count);
+    // Any hit rays are done once occluded
+    uint64_t doneMask = AnyHit ? hitMask : 0;
+    float minT, maxT = packetMaxT(boxRays, count, hitRecords, doneMask, minT);
+
+    struct StackEntry {
+        int32_t node;
+        int32_t first;
+    };
+    StackEntry stack[kStackSize];
+    int stackSize = 0;
+    stack[stackSize++] = { 0, 0 };
+    while (stackSize > 0)
+    {
+        StackEntry entry = stack[--stackSize];
+        const BVHnode& node = m_nodes[entry.node];
+        if (frustum.m_coherent && !frustum.hit(node.m_aabb, minT, maxT)) continue;
+        // First ray entering the node before its closest hit so far
+        int first = entry.first;
+        float tmin, tmax;
+        while (first < count && ((doneMask & (uint64_t(1) << first)) || !node.m_aabb.hit(boxRays[first], tmin, tmax) || tmin > hitRecords[first].parT)) first++;
+        if (first == count) continue;
+        if (node.isLeaf())
+        {
+            for (int r = first; r < count; r++)
+            {
+                if (doneMask & (uint64_t(1) << r)) continue;
+                if (r > first && (!node.m_aabb.hit(boxRays[r], tmin, tmax) || tmin > hitRecords[r].parT)) continue;
+                bool leafHit = m_watertight ? intersectLeafWatertight<AnyHit>(rays[r], mesh, node.m_offset, node.m_nTriangles, hitRecords[r])
+                                            : intersectLeaf<AnyHit>(boxRays[r], node.m_offset, node.m_nTriangles, hitRecords[r]);
+                if (!leafHit) continue;
+                hitMask |= uint64_t(1) << r;
+                if (AnyHit) doneMask |= uint64_t(1) << r;
+            }
+            maxT = packetMaxT(boxRays, count, hitRecords, doneMask, minT);
+            if (maxT < 0.f) return;
+            continue;
+        }
+        // Nearest child last on the stack, along the direction of the packet (or of its first active ray)
+        int sign = frustum.m_coherent ? frustum.m_sign[node.m_axis] : boxRays[first].m_sign[node.m_axis];
+        if (sign)
+        {
+            stack[stackSize++] = { entry.node + 1, first };
+            stack[stackSize++] = { node.m_offset, first };
+        }
+        else
+        {
+            stack[stackSize++] = { node.m_offset, first };
+            stack[stackSize++] = { entry.node + 1, first };
+        }
+    }
+}
+
+void BVH::scale(float scale)
+{
+    m_transformed = true;
+    m_scale *= scale;
+    m_translation *= scale;
+    AABB aabb{};
+    aabb.compareAndUpdate(m_aabb.min() * scale);
+    aabb.compareAndUpdate(m_aabb.max() * scale);
+    m_aabb = aabb;
+}
+
+void BVH::translate(const Vec3f& translation)
+{
+    m_transformed = true;
+    m_translation += translation;
+    m_aabb = AABB(m_aabb.min() + translation, m_aabb.max() + translation);
+}
+
+BVHroot::BVHroot(const std::vector<Mesh>& meshes, const BVHBuildParams& params) : m_params(params)
+{
+    // One task per mesh BVH, large meshes spawn their own subtree tasks in the same team
+    m_meshBVHs.resize(meshes.size());
+    #pragma omp parallel if(params.parallel)
+    #pragma omp single
+    {
+        for (int i = 0; i < int(meshes.size()); i++)
+        {
+            #pragma omp task firstprivate(i) if(params.parallel)
+            m_meshBVHs[i] = BVH(meshes[i], i, params);
+        }
+        #pragma omp taskwait
+        buildTopLevel();
+    }
+}
+
+void BVHroot::buildTopLevel()
+{
+    // Empty meshes are left out of the top level
+    std::vector<AABB> instanceBoxes;
+    std::vector<int> instances;
+    m_aabb = AABB();
+    for (int i = 0; i < int(m_meshBVHs.size()); i++)
+    {
+        if (m_meshBVHs[i].nodes().size() == 0) continue;
+        instanceBoxes.push_back(m_meshBVHs[i].boundingBox());
+        instances.push_back(i);
+        m_aabb.compareAndUpdate(m_meshBVHs[i].boundingBox());
+    }
+    BVHBuildParams topLevelParams = m_params;
+    topLevelParams.maxLeafSize = 1;
+    BVHbuilder builder(topLevelParams, instanceBoxes);
+    builder.build(m_nodes);
+    const std::vector<int>& order = builder.order();
+    m_instances.resize(order.size());
+    for (int i = 0; i < int(order.size()); i++)
+    {
+        m_instances[i] = instances[order[i]];
+    }
+}
+
+void BVHroot::scaleMesh(size_t meshIndex, float scale)
+{
+    m_meshBVHs[meshIndex].scale(scale);
+    buildTopLevel();
+}
+
+void BVHroot::translateMesh(size_t meshIndex, const Vec3f& translation)
+{
+    m_meshBVHs[meshIndex].translate(translation);
+    buildTopLevel();
+}
+
+bool BVHroot::hit(const Ray& ray, hitInfo& hitRecord, const std::vector<Mesh>& meshes) const
+{
+    return traverse<false>(ray, hitRecord, meshes);
+}
+
+bool BVHroot::occluded(const Ray& ray, const std::vector<Mesh>& meshes) const
+{
+    hitInfo hitRecord{};
+    hitRecord.parT = ray.m_tMax;
+    return traverse<true>(ray, hitRecord, meshes);
+}
+
+template <bool AnyHit>
+bool BVHroot::traverse(const Ray& ray, hitInfo& hitRecord, const std::vector<Mesh>& meshes) const
+{
+    if (m_nodes.size() == 0) return false;
+    // closestHit is shared so that each mesh only reports hits closer than the current one
+    hitInfo closestHit = hitRecord;
+    bool intersect = false;
+    int stack[BVH::kStackSize];
+    float stackT[BVH::kStackSize];
+    int stackSize = 0;
+    float tmin, tmax;
+    if (!m_nodes[0].m_aabb.hit(ray, tmin, tmax)) return false;
+    stack[stackSize] = 0; stackT[stackSize++] = tmin;
+    while (stackSize > 0)
+    {
+        --stackSize;
+        // Early termination : the node is entered after the closest hit found so far
+        if (stackT[stackSize] > closestHit.parT) continue;
+        int nodeIndex = stack[stackSize];
+        const BVHnode& node = m_nodes[nodeIndex];
+        if (node.isLeaf())
+        {
+            for (int i = node.m_offset; i < node.m_offset + node.m_nTriangles; i++)
+            {
+                if (AnyHit && m_meshBVHs[m_instances[i]].occluded(ray, meshes)) return true;
+                if (!AnyHit && m_meshBVHs[m_instances[i]].hit(ray, closestHit, meshes)) intersect = true;
+            }
+            continue;
+        }
+        // Ordered traversal : push the farthest child first so that the nearest one is visited first
+        int children[2] = { nodeIndex + 1, node.m_offset };
+        float childT[2];
+        bool childHit[2];
+        for (int c = 0; c < 2; c++)
+        {
+            childHit[c] = m_nodes[children[c]].m_aabb.hit(ray, childT[c], tmax) && childT[c] <= closestHit.parT;
+        }
+        int nearest = childT[1] < childT[0] ? 1 : 0;
+        if (childHit[1 - nearest]) { stack[stackSize] = children[1 - nearest]; stackT[stackSize++] = childT[1 - nearest]; }
+        if (childHit[nearest]) { stack[stackSize] = children[nearest]; stackT[stackSize++] = childT[nearest]; }
+    }
+    hitRecord = closestHit;
+    return intersect;
+}
+
+uint64_t BVHroot::hit(const Ray* rays, int count, hitInfo* hitRecords, const std::vector<Mesh>& meshes) const
+{
+    return traversePacket<false>(rays, count, hitRecords, meshes);
+}
+
+uint64_t BVHroot::occluded(const Ray* rays, int count, const std::vector<Mesh>& meshes) const
+{
+    hitInfo hitRecords[BVH::kPacketSize];
+    for (int r = 0; r < count; r++) hitRecords[r].parT = rays[r].m_tMax;
+    return traversePacket<true>(rays, count, hitRecords, meshes);
+}
+
+template <bool AnyHit>
+uint64_t BVHroot::traversePacket(const Ray* rays, int count, hitInfo* hitRecords, const std::vector<Mesh>& meshes) const
+{
+    uint64_t hitMask = 0;
+    if (m_nodes.size() == 0 || count == 0) return hitMask;
+    uint64_t allRays = count == BVH::kPacketSize ? ~uint64_t(0) : (uint64_t(1) << count) - 1;
+    PacketFrustum frustum(rays, count);
+    float minT, maxT = packetMaxT(rays, count, hitRecords, 0, minT);
+    struct StackEntry {
+        int32_t node;
+        int32_t first;
+    };
+    StackEntry stack[BVH::kStackSize];
+    int stackSize = 0;
+    stack[stackSize++] = { 0, 0 };
+    while (stackSize > 0)
+    {
+        StackEntry entry = stack[--stackSize];
+        const BVHnode& node = m_nodes[entry.node];
+        if (frustum.m_coherent && !frustum.hit(node.m_aabb, minT, maxT)) continue;
+        int first = entry.first;
+        float tmin, tmax;
+        while (first < count && ((AnyHit && (hitMask & (uint64_t(1) << first))) || !node.m_aabb.hit(rays[first], tmin, tmax) || tmin > hitRecords[first].parT)) first++;
+        if (first == count) continue;
+        if (node.isLeaf())
+        {
+            // The mesh BVHs only see the rays from the first one entering the leaf
+            for (int i = node.m_offset; i < node.m_offset + node.m_nTriangles; i++)
+            {
+                uint64_t meshMask = AnyHit ? hitMask >> first : 0;
+                m_meshBVHs[m_instances[i]].traversePacket<AnyHit>(rays + first, count - first, hitRecords + first, meshMask, meshes);
+                hitMask |= meshMask << first;
+            }
+            if (AnyHit && hitMask == allRays) return hitMask;
+            maxT = packetMaxT(rays, count, hitRecords, AnyHit ? hitMask : 0, minT);
+            continue;
+        }
+        int sign = frustum.m_coherent ? frustum.m_sign[node.m_axis] : rays[first].m_sign[node.m_axis];
+        if (sign)
+        {
+            stack[stackSize++] = { entry.node + 1, first };
+            stack[stackSize++] = { node.m_offset, first };
+        }
+        else
+        {
+            stack[stackSize++] = { node.m_offset, first };
+            stack[stackSize++] = { entry.node + 1, first };
+        }
+    }
+    return hitMask;
+}
+
+float BVHroot::sahCost(const BVHBuildParams& params) const
+{
+    if (m_nodes.size() == 0) return 0.f;
+    // Top level nodes cost a box test, reaching a leaf costs the whole mesh BVH
+    float rootArea = m_aabb.surfaceArea();
+    float cost = 0.f;
+    for (int i = 0; i < int(m_nodes.size()); i++)
+    {
+        const BVHnode& node = m_nodes[i];
+        float probability = rootArea > 0.f ? node.m_aabb.surfaceArea() / rootArea : 1.f;
+        if (!node.isLeaf())
+        {
+            cost += probability * params.traversalCost;
+            continue;
+        }
+        for (int k = node.m_offset; k < node.m_offset + node.m_nTriangles; k++)
+        {
+            cost += probability * m_meshBVHs[m_instances[k]].sahCost(params);
+        }
+    }
+    return cost;
+}
@@ -1,84 +1,194 @@
 #pragma once
 #include <vector>
 #include <algorithm>
+#include <cstdint>
+#include <omp.h>
 
 #include "Vec3.h"
 #include "mesh.h"
 #include "boundingVolume.h"
+#include "simd.h"
 
 struct hitInfo {
 	float parT;
 	Vec3f barCoord;
 	size_t meshIndex;
 	Vec3i triangleIndices;
+	int triangle = -1;                                   // index of the triangle in the mesh indices
 	hitInfo() { parT = std::numeric_limits<float>::max(); meshIndex = -1; };
 	hitInfo(float _parT, Vec3f _barCoord, size_t _meshIndex, Vec3i _trianglesIndices) : parT(_parT), barCoord(_barCoord), meshIndex(_meshIndex), triangleIndices(_trianglesIndices) {};
 };
 
+// Node of a linear BVH (32 bytes). Nodes are stored in depth-first order : the first child
+// of an interior node is the next node in the array, m_offset is the index of the second child.
+// For a leaf, m_offset is the index of its first triangle in the BVH triangle array.
+struct BVHnode {
+    AABB m_aabb{};
+    int32_t m_offset = -1;
+    uint16_t m_nTriangles = 0;
+    uint8_t m_axis = 0;
+    uint8_t m_pad = 0;
+    inline bool isLeaf() const { return m_nTriangles > 0; }
+};
+static_assert(sizeof(BVHnode) == 32, "BVHnode should fit in 32 bytes");
+
+// Node of a wide BVH, collapsed from the binary one. The bounds of the N children are stored as
+// structure of arrays (m_bounds[min/max][axis][child]) so that one ray is tested against all of them at once.
+// m_child is the index of an interior child, or the first triangle of a leaf child, -1 for an empty slot.
+template <int N>
+struct alignas(32) WideBVHnode {
+    float m_bounds[2][3][N];
+    int32_t m_child[N];
+    uint16_t m_nTriangles[N];
+};
+
+// Leaf triangles gathered by groups of kTriangleBlockSize as structure of arrays (m_v0[axis][lane]),
+// with the two edges from the first vertex precomputed. Unused lanes are left to zero and never hit.
+#ifdef SIMD_AVX
+const int kTriangleBlockSize = 8;
+#else
+const int kTriangleBlockSize = 4;
+#endif
+struct alignas(32) TriangleBlock {
+    float m_v0[3][kTriangleBlockSize];
+    float m_edge1[3][kTriangleBlockSize];
+    float m_edge2[3][kTriangleBlockSize];
+};
+
+// BVH construction settings
+struct BVHBuildParams {
+    enum SplitMethod
+    {
+        MEDIAN, // split on the median centroid of the longest axis
+        SAH,    // binned surface area heuristic
+    };
+    SplitMethod splitMethod = SAH;
+    int binCount = 16;
+    float traversalCost = 1.f;     // cost of visiting an interior node
+    float intersectionCost = 1.f;  // cost of intersecting one triangle in a leaf
+    int maxLeafSize = 8;
+    bool parallel = true;          // build with OpenMP tasks
+    int taskThreshold = 4096;      // minimum number of primitives on both sides of a split to build them in parallel
+    int width = 2;                 // children per node used for traversal : 2, 4 or 8
+    bool watertight = false;       // intersect leaves with the watertight test on the mesh vertices instead of the SIMD blocks
+    bool lightBVH = true;          // also build the light BVH used to sample the emissive triangles (see LightBVH)
+};
 
-class BVHnode {
+// Builds a linear BVH over primitives given by their bounding boxes.
+// The primitive order is rearranged so that each leaf references a contiguous range.
+class BVHbuilder {
 
 public:
-    using BVHptr = std::shared_ptr<BVHnode>;
-    typedef std::shared_ptr<BVHnode> BVHptr;
+    // Past this depth the SAH builder falls back to median splits so that the traversal stack can't overflow
+    static const int kMaxSAHDepth = 64;
+
+    BVHbuilder(const BVHBuildParams& params, const std::vector<AABB>& primitiveBoxes);
+    void build(std::vector<BVHnode>& nodes);
+    inline const std::vector<int>& order() const { return m_order; }
+
+private:
+    void buildRoot(std::vector<BVHnode>& nodes);
+    void computeBounds(int begin, int end, AABB& aabb, AABB& centroidBox) const;
+    int build(std::vector<BVHnode>& nodes, int begin, int end, int depth);
+    int findSAHSplit(int begin, int end, const AABB& aabb, const AABB& centroidBox, int& dimension);
+
+    BVHBuildParams m_params;
+    const std::vector<AABB>& m_boxes;
+    std::vector<Vec3f> m_centroids;
+    std::vector<int> m_order;
+};
+
+// Bottom level BVH over the triangles of a single mesh
+class BVH {
 
-    inline BVHnode() {}    
-    BVHnode(const std::vector<Vec3i>& connectivity, const AABB& aabb, const Mesh& mod, int meshIndex);
-    bool hit(const Ray& ray, hitInfo& hitRecord, const std::vector<Mesh>& meshes);
+public:
+    static const int kStackSize = 128;
+    // Rays per packet, one bit each in the hit masks
+    static const int kPacketSize = 64;
+
+    inline BVH() {}
+    BVH(const Mesh& mesh, int meshIndex, const BVHBuildParams& params = BVHBuildParams());
+    bool hit(const Ray& ray, hitInfo& hitRecord, const std::vector<Mesh>& meshes) const;
+    // Any hit query : true as soon as a triangle is found in [ray.m_tMin, ray.m_tMax]
+    bool occluded(const Ray& ray, const std::vector<Mesh>& meshes) const;
+    // Packet traversal of up to kPacketSize coherent rays (see BVHroot::hit)
+    template <bool AnyHit>
+    void traversePacket(const Ray* rays, int count, hitInfo* hitRecords, uint64_t& hitMask, const std::vector<Mesh>& meshes) const;
+    float sahCost(const BVHBuildParams& params) const;
+    // Record a scale then translation applied to the mesh after the build (see Mesh::scale, Mesh::translate)
+    void scale(float scale);
+    void translate(const Vec3f& translation);
+    inline const AABB& boundingBox() const { return m_aabb; }
+    inline const std::vector<BVHnode>& nodes() const { return m_nodes; }
+    inline const std::vector<Vec3i>& triangles() const { return m_triangles; }
 
 private:
-    BVHptr m_left = nullptr;
-    BVHptr m_right = nullptr;
+    // Closest hit traversal, or any hit traversal stopping at the first triangle closer than hitRecord.parT
+    template <bool AnyHit>
+    bool traverse(const Ray& ray, hitInfo& hitRecord, const std::vector<Mesh>& meshes) const;
+    template <bool AnyHit>
+    bool intersectLeaf(const Ray& boxRay, int offset, int count, hitInfo& hitRecord) const;
+    template <bool AnyHit>
+    bool intersectLeafWatertight(const Ray& ray, const Mesh& mesh, int offset, int count, hitInfo& hitRecord) const;
+    template <int N>
+    void collapse(std::vector<WideBVHnode<N>>& wideNodes) const;
+    template <int N>
+    int collapseNode(std::vector<WideBVHnode<N>>& wideNodes, int nodeIndex) const;
+    template <int N, bool AnyHit>
+    bool traverseWide(const std::vector<WideBVHnode<N>>& wideNodes, const Ray& ray, const Ray& boxRay, const Mesh& mesh, hitInfo& hitRecord) const;
+
+    std::vector<BVHnode> m_nodes{};
+    std::vector<WideBVHnode<4>> m_nodes4{};
+    std::vector<WideBVHnode<8>> m_nodes8{};
+    int m_width = 2;
+    bool m_watertight = false;
+    // Leaves start on a block boundary and are padded to whole blocks, padding entries are Vec3i(-1, -1, -1)
+    std::vector<Vec3i> m_triangles{};
+    std::vector<int> m_triangleIds{};  // index in the mesh indices of each entry of m_triangles, -1 for padding
+    std::vector<TriangleBlock> m_blocks{};
     AABB m_aabb{};
-    std::vector<Vec3i> m_connectivity{};    
     int m_meshIndex = -1;
+    // Transform from the space the nodes were built in to the current mesh space : p * m_scale + m_translation.
+    // Boxes and triangle blocks are tested in build space, which doesn't change the hit distance or barycentrics.
+    bool m_transformed = false;
+    float m_scale = 1.f;
+    Vec3f m_translation{};
 };
 
+// Two level acceleration structure : a top level BVH over the bounding boxes of the mesh BVHs
 class BVHroot {
 
 public:
     inline BVHroot() {}
-
-    inline BVHroot(const std::vector<Mesh>& meshes)        
-    {
-        Vec3f minScene, maxScene;
-        for (int i = 0; i < meshes.size(); i++)
-        {
-            AABB BB = meshes[i].boundingBox();
-            for (int k = 0; k < 3; k++)
-            {
-                if (BB.min()[k] < minScene[k]) minScene[k] = BB.min()[k];
-                if (BB.max()[k] > maxScene[k]) maxScene[k] = BB.max()[k];
-            }
-            m_nodes.push_back(BVHnode::BVHptr(new BVHnode(meshes[i].indices(), BB, meshes[i], i)));
-        }
-        m_aabb = AABB(minScene, maxScene);
-    };
-
-    bool hit(const Ray& ray, hitInfo& hitRecord, const std::vector<Mesh>& meshes) const
-    {
-        hitInfo closestHit{}; bool intersect = false;
-        for (int i = 0; i < m_nodes.size(); i++)
-        {
-            hitInfo meshHitInfo{};                        
-            if (m_nodes[i]->hit(ray, meshHitInfo, meshes))
-            {            
-                intersect = true;
-                if (meshHitInfo.parT < closestHit.parT)
-                {                                                                
-                    closestHit = meshHitInfo;
-                }
-            }
-        }        
-        hitRecord = closestHit;
-        return intersect;
-    }
+    BVHroot(const std::vector<Mesh>& meshes, const BVHBuildParams& params = BVHBuildParams());
+
+    bool hit(const Ray& ray, hitInfo& hitRecord, const std::vector<Mesh>& meshes) const;
+    bool occluded(const Ray& ray, const std::vector<Mesh>& meshes) const;
+    // Packets of up to BVH::kPacketSize rays traced together : a node is fetched once for the whole packet and skipped
+    // when the frustum bounding the rays misses it. Works best for rays with close origins and directions, such as
+    // camera rays of neighbouring pixels or shadow rays towards the same light. Returns the mask of the rays that hit,
+    // hitRecords are used as in the single ray versions.
+    uint64_t hit(const Ray* rays, int count, hitInfo* hitRecords, const std::vector<Mesh>& meshes) const;
+    uint64_t occluded(const Ray* rays, int count, const std::vector<Mesh>& meshes) const;
+
+    // Move a mesh BVH along with its mesh and only rebuild the top level
+    void scaleMesh(size_t meshIndex, float scale);
+    void translateMesh(size_t meshIndex, const Vec3f& translation);
+    void buildTopLevel();
+
+    // Expected cost of a ray hitting the scene bounds
+    float sahCost(const BVHBuildParams& params) const;
+    inline const AABB& boundingBox() const { return m_aabb; }
 
 private:
-    std::vector<BVHnode::BVHptr> m_nodes;
+    template <bool AnyHit>
+    bool traverse(const Ray& ray, hitInfo& hitRecord, const std::vector<Mesh>& meshes) const;
+    template <bool AnyHit>
+    uint64_t traversePacket(const Ray* rays, int count, hitInfo* hitRecords, const std::vector<Mesh>& meshes) const;
+
+    std::vector<BVH> m_meshBVHs;
+    std::vector<BVHnode> m_nodes;
+    std::vector<int> m_instances;
+    BVHBuildParams m_params;
     AABB m_aabb;
 };
-
-
-
-
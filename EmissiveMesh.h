@@ -2,6 +2,7 @@
 #include "mesh.h"
 #include "Vec3.h"
 #include "GeometryHelper.h"
+#include "rng.h"
 
 class EmissiveMesh : public Mesh
 {
@@ -11,12 +12,14 @@ public:
 		m_mat = MaterialEmissive(color, emissive);
 	}
 
-	static Vec3f getRandomPointOnSurface(const Mesh& mesh)
+	static Vec3f getRandomPointOnSurface(const Mesh& mesh, RNG& rng)
 	{
 		if (mesh.indices().size() == 0) return Vec3f{};
-		size_t rdIndex = size_t((mesh.indices().size()-1) * (static_cast <float> (rand()) / static_cast <float> (RAND_MAX)));
+		size_t rdIndex = rng.nextUInt(uint32_t(mesh.indices().size()));
 		auto& rdTri = mesh.triangle(mesh.indices()[rdIndex]);
-		return GeometryHelper::sampleTriangleUniformly(rdTri);
+		float r1 = rng.nextFloat();
+		float r2 = rng.nextFloat();
+		return GeometryHelper::sampleTriangleUniformly(rdTri, r1, r2);
 	}
 };
 
@@ -25,19 +25,28 @@ Vec3f GeometryHelper::sampleDiskUniform(float rdX, float rdY)
 
 }
 
+// Express a direction given in the local frame (z along the normal) in world space
 Vec3f GeometryHelper::orientAlongNormal(const Vec3f& input, const Vec3f& normal)
 {
-    Vec3f ortho = perp_stark(input);
-    Vec3f tangent = cross(ortho, normal);
+    Vec3f ortho = normalize(perp_stark(normal));
+    Vec3f tangent = cross(normal, ortho);
     return input[0] * ortho + input[1] * tangent + input[2] * normal;
 }
 
+// Inverse of orientAlongNormal
+Vec3f GeometryHelper::toNormalFrame(const Vec3f& input, const Vec3f& normal)
+{
+    Vec3f ortho = normalize(perp_stark(normal));
+    Vec3f tangent = cross(normal, ortho);
+    return Vec3f(dot(input, ortho), dot(input, tangent), dot(input, normal));
+}
+
 Vec3f GeometryHelper::sampleCosineHemisphereConcentric(float rdX, float rdY, const Vec3f& normal, float& pdf)
 {
     Vec3f randomDiskPoint = sampleDiskUniform(rdX, rdY);
     float z = sqrt(fmaxf(0.f, 1.f - dot(randomDiskPoint, randomDiskPoint)));
     pdf = z * M_1_PI;
-    Vec3f direction = (randomDiskPoint[0], randomDiskPoint[1], z);
+    Vec3f direction(randomDiskPoint[0], randomDiskPoint[1], z);
     Vec3f localDirection = orientAlongNormal(direction, normal);
     return localDirection;
 }
\ No newline at end of file
@@ -13,34 +13,30 @@ public:
         return normalize(cross(triangle[1] - triangle[0], triangle[2] - triangle[0]));
     }
 
+    inline static float computeTriangleArea(const Vec3<Vec3f>& triangle)
+    {
+        return 0.5f * cross(triangle[1] - triangle[0], triangle[2] - triangle[0]).length();
+    }
+
 	static Vec3f sampleCosineHemisphereConcentric(float rdX, float rdY, const Vec3f& normal, float& pdf);
 
     /// <summary>
     /// Sample input triangle uniformly and returns a random point on this triangle. ref : https://math.stackexchange.com/questions/18686/uniform-random-point-in-triangle-in-3d
     /// </summary>
     /// <param name="triangle : input triangle"></param>
+    /// <param name="r1, r2 : uniform random numbers in [0,1)"></param>
     /// <returns></returns>
-    inline static Vec3f sampleTriangleUniformly(const Vec3<Vec3f>& triangle)
+    inline static Vec3f sampleTriangleUniformly(const Vec3<Vec3f>& triangle, float r1, float r2)
     {
-        float r1 = random(0, 1);
-        float r2 = random(0, 1);
         float r1Sqrt = sqrt(r1);
         return (1 - r1Sqrt) * triangle[0] + (r1Sqrt * (1 - r2)) * triangle[1] + (r2 * r1Sqrt) * triangle[2];
     }
 
-    /// <summary>
-    /// Returns a random float in specified range
-    /// </summary>
-    /// <param name="min"></param>
-    /// <param name="max"></param>
-    /// <returns></returns>
-    inline static float random(float min, float max)
-    {
-        return min + static_cast <float> (rand()) / (static_cast <float> (RAND_MAX / (max - min)));
-    }
+    // Local frame with z along the normal, the same frame for both directions
+    static Vec3f orientAlongNormal(const Vec3f& input, const Vec3f& normal);
+    static Vec3f toNormalFrame(const Vec3f& input, const Vec3f& normal);
 
 private:
-    static Vec3f orientAlongNormal(const Vec3f& input, const Vec3f& normal);
 
     inline static Vec3f perp_stark(const Vec3f & u)
     {
@@ -36,11 +36,9 @@ public:
       m_p[2] = p;
   };
 
-  inline Vec3 (const Vec3 & v) {
-    init (v[0], v[1], v[2]);
-  }
-
-  ~Vec3() {}
+  // Defaulted so that Vec3 stays trivially copyable
+  Vec3 (const Vec3 & v) = default;
+  Vec3& operator= (const Vec3 & p) = default;
 
   inline T& operator[] (int Index) {
     return (m_p[Index]);
@@ -50,13 +48,6 @@ public:
     return (m_p[Index]);
   };
 
-  inline Vec3& operator= (const Vec3 & p) {
-    m_p[0] = p[0];
-    m_p[1] = p[1];
-    m_p[2] = p[2];
-    return (*this);
-  };
-
   inline Vec3& operator+= (const Vec3 & p) {
     m_p[0] += p[0];
     m_p[1] += p[1];
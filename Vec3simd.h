@@ -0,0 +1,281 @@
+#pragma once
+#include <cmath>
+#include "simd.h"
+#include "Vec3.h"
+
+// Float vectors for the SIMD code, backed by SSE / AVX registers when simd.h enables them and by plain arrays
+// otherwise. They have the operators of Vec3f, and compute them in the same order : a lane gives the same
+// result as the Vec3f code as long as the compiler doesn't fuse multiplications and additions differently.
+
+/// <summary>
+/// Vec3f padded to 16 bytes and held in an SSE register, the fourth lane is unused.
+/// Converts implicitly from and to Vec3f so that it can replace a Vec3f member without touching its users.
+/// </summary>
+struct alignas(16) Vec3fa
+{
+	union
+	{
+#if defined(SIMD_SSE)
+		__m128 m_v;
+#endif
+		float m_p[4];
+	};
+
+#if defined(SIMD_SSE)
+	inline Vec3fa() : m_v(_mm_setzero_ps()) {}
+	inline explicit Vec3fa(__m128 v) : m_v(v) {}
+	inline Vec3fa(float x, float y, float z) : m_v(_mm_set_ps(0.f, z, y, x)) {}
+#else
+	inline Vec3fa() : m_p{ 0.f, 0.f, 0.f, 0.f } {}
+	inline Vec3fa(float x, float y, float z) : m_p{ x, y, z, 0.f } {}
+#endif
+	inline explicit Vec3fa(float s) : Vec3fa(s, s, s) {}
+	inline Vec3fa(const Vec3f& v) : Vec3fa(v[0], v[1], v[2]) {}
+	inline operator Vec3f() const { return Vec3f(m_p[0], m_p[1], m_p[2]); }
+
+	inline float& operator[](int index) { return m_p[index]; }
+	inline const float& operator[](int index) const { return m_p[index]; }
+
+	inline Vec3fa& operator+=(const Vec3fa& p);
+	inline Vec3fa& operator-=(const Vec3fa& p);
+	inline Vec3fa& operator*=(const Vec3fa& p);
+	inline Vec3fa& operator*=(float s);
+	inline Vec3fa& operator/=(float s);
+
+	inline float squaredLength() const;
+	inline float length() const { return std::sqrt(squaredLength()); }
+	// Returns the length before normalization, zero vectors are left unchanged like Vec3f::normalize
+	inline float normalize();
+};
+
+#if defined(SIMD_SSE)
+inline Vec3fa operator+(const Vec3fa& a, const Vec3fa& b) { return Vec3fa(_mm_add_ps(a.m_v, b.m_v)); }
+inline Vec3fa operator-(const Vec3fa& a, const Vec3fa& b) { return Vec3fa(_mm_sub_ps(a.m_v, b.m_v)); }
+inline Vec3fa operator*(const Vec3fa& a, const Vec3fa& b) { return Vec3fa(_mm_mul_ps(a.m_v, b.m_v)); }
+inline Vec3fa operator/(const Vec3fa& a, const Vec3fa& b) { return Vec3fa(_mm_div_ps(a.m_v, b.m_v)); }
+inline Vec3fa operator*(const Vec3fa& a, float s) { return Vec3fa(_mm_mul_ps(a.m_v, _mm_set1_ps(s))); }
+inline Vec3fa operator/(const Vec3fa& a, float s) { return Vec3fa(_mm_div_ps(a.m_v, _mm_set1_ps(s))); }
+inline Vec3fa operator-(const Vec3fa& a) { return Vec3fa(_mm_xor_ps(a.m_v, _mm_set1_ps(-0.f))); }
+// a < b ? a : b per component, like _mm_min_ps : NaNs of a are replaced by b
+inline Vec3fa vmin(const Vec3fa& a, const Vec3fa& b) { return Vec3fa(_mm_min_ps(a.m_v, b.m_v)); }
+inline Vec3fa vmax(const Vec3fa& a, const Vec3fa& b) { return Vec3fa(_mm_max_ps(a.m_v, b.m_v)); }
+
+inline float dot(const Vec3fa& a, const Vec3fa& b)
+{
+	__m128 m = _mm_mul_ps(a.m_v, b.m_v);
+	__m128 xy = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_cvtss_f32(_mm_add_ss(xy, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 2, 2, 2))));
+}
+
+inline Vec3fa cross(const Vec3fa& a, const Vec3fa& b)
+{
+	__m128 aYZX = _mm_shuffle_ps(a.m_v, a.m_v, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 aZXY = _mm_shuffle_ps(a.m_v, a.m_v, _MM_SHUFFLE(3, 1, 0, 2));
+	__m128 bYZX = _mm_shuffle_ps(b.m_v, b.m_v, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 bZXY = _mm_shuffle_ps(b.m_v, b.m_v, _MM_SHUFFLE(3, 1, 0, 2));
+	return Vec3fa(_mm_sub_ps(_mm_mul_ps(aYZX, bZXY), _mm_mul_ps(aZXY, bYZX)));
+}
+#else
+inline Vec3fa operator+(const Vec3fa& a, const Vec3fa& b) { return Vec3fa(a[0] + b[0], a[1] + b[1], a[2] + b[2]); }
+inline Vec3fa operator-(const Vec3fa& a, const Vec3fa& b) { return Vec3fa(a[0] - b[0], a[1] - b[1], a[2] - b[2]); }
+inline Vec3fa operator*(const Vec3fa& a, const Vec3fa& b) { return Vec3fa(a[0] * b[0], a[1] * b[1], a[2] * b[2]); }
+inline Vec3fa operator/(const Vec3fa& a, const Vec3fa& b) { return Vec3fa(a[0] / b[0], a[1] / b[1], a[2] / b[2]); }
+inline Vec3fa operator*(const Vec3fa& a, float s) { return Vec3fa(a[0] * s, a[1] * s, a[2] * s); }
+inline Vec3fa operator/(const Vec3fa& a, float s) { return Vec3fa(a[0] / s, a[1] / s, a[2] / s); }
+inline Vec3fa operator-(const Vec3fa& a) { return Vec3fa(-a[0], -a[1], -a[2]); }
+// a < b ? a : b per component, like _mm_min_ps : NaNs of a are replaced by b
+inline Vec3fa vmin(const Vec3fa& a, const Vec3fa& b) { return Vec3fa(a[0] < b[0] ? a[0] : b[0], a[1] < b[1] ? a[1] : b[1], a[2] < b[2] ? a[2] : b[2]); }
+inline Vec3fa vmax(const Vec3fa& a, const Vec3fa& b) { return Vec3fa(a[0] > b[0] ? a[0] : b[0], a[1] > b[1] ? a[1] : b[1], a[2] > b[2] ? a[2] : b[2]); }
+
+inline float dot(const Vec3fa& a, const Vec3fa& b)
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+inline Vec3fa cross(const Vec3fa& a, const Vec3fa& b)
+{
+	return Vec3fa(a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]);
+}
+#endif
+
+inline Vec3fa operator*(float s, const Vec3fa& a) { return a * s; }
+// Without these, Vec3f op Vec3fa would be ambiguous between the Vec3f members and the Vec3fa operators
+inline Vec3fa operator+(const Vec3f& a, const Vec3fa& b) { return Vec3fa(a) + b; }
+inline Vec3fa operator-(const Vec3f& a, const Vec3fa& b) { return Vec3fa(a) - b; }
+inline Vec3fa operator*(const Vec3f& a, const Vec3fa& b) { return Vec3fa(a) * b; }
+inline Vec3fa operator/(const Vec3f& a, const Vec3fa& b) { return Vec3fa(a) / b; }
+
+inline Vec3fa& Vec3fa::operator+=(const Vec3fa& p) { return *this = *this + p; }
+inline Vec3fa& Vec3fa::operator-=(const Vec3fa& p) { return *this = *this - p; }
+inline Vec3fa& Vec3fa::operator*=(const Vec3fa& p) { return *this = *this * p; }
+inline Vec3fa& Vec3fa::operator*=(float s) { return *this = *this * s; }
+inline Vec3fa& Vec3fa::operator/=(float s) { return *this = *this / s; }
+inline float Vec3fa::squaredLength() const { return dot(*this, *this); }
+
+inline float Vec3fa::normalize()
+{
+	float l = length();
+	if (l == 0.f) return 0.f;
+	*this *= 1.f / l;
+	return l;
+}
+
+inline float length(const Vec3fa& a) { return a.length(); }
+
+inline Vec3fa normalize(const Vec3fa& a)
+{
+	Vec3fa n(a);
+	n.normalize();
+	return n;
+}
+
+inline Vec3fa mix(const Vec3fa& u, const Vec3fa& v, float alpha) { return u * (1.f - alpha) + v * alpha; }
+
+// 1 / a per component, exact division
+inline Vec3fa reciprocal(const Vec3fa& a) { return Vec3fa(1.f) / a; }
+
+/// <summary>
+/// Comparison result of 8 lanes, see Float8
+/// </summary>
+struct Bool8
+{
+#if defined(SIMD_AVX)
+	__m256 m_v;
+	inline Bool8() {}
+	inline explicit Bool8(__m256 v) : m_v(v) {}
+#else
+	bool m_v[8];
+#endif
+};
+
+/// <summary>
+/// 8 floats in an AVX register. Default construction leaves the lanes uninitialized like __m256
+/// </summary>
+struct Float8
+{
+	union
+	{
+#if defined(SIMD_AVX)
+		__m256 m_v;
+#endif
+		float m_p[8];
+	};
+
+#if defined(SIMD_AVX)
+	inline Float8() {}
+	inline explicit Float8(__m256 v) : m_v(v) {}
+	inline Float8(float s) : m_v(_mm256_set1_ps(s)) {}
+	static inline Float8 load(const float* p) { return Float8(_mm256_loadu_ps(p)); }
+	inline void store(float* p) const { _mm256_storeu_ps(p, m_v); }
+#else
+	inline Float8() {}
+	inline Float8(float s) { for (int lane = 0; lane < 8; lane++) m_p[lane] = s; }
+	static inline Float8 load(const float* p) { Float8 r; for (int lane = 0; lane < 8; lane++) r.m_p[lane] = p[lane]; return r; }
+	inline void store(float* p) const { for (int lane = 0; lane < 8; lane++) p[lane] = m_p[lane]; }
+#endif
+
+	inline float operator[](int lane) const { return m_p[lane]; }
+};
+
+#if defined(SIMD_AVX)
+inline Float8 operator+(const Float8& a, const Float8& b) { return Float8(_mm256_add_ps(a.m_v, b.m_v)); }
+inline Float8 operator-(const Float8& a, const Float8& b) { return Float8(_mm256_sub_ps(a.m_v, b.m_v)); }
+inline Float8 operator*(const Float8& a, const Float8& b) { return Float8(_mm256_mul_ps(a.m_v, b.m_v)); }
+inline Float8 operator/(const Float8& a, const Float8& b) { return Float8(_mm256_div_ps(a.m_v, b.m_v)); }
+inline Float8 operator-(const Float8& a) { return Float8(_mm256_xor_ps(a.m_v, _mm256_set1_ps(-0.f))); }
+inline Float8 vmin(const Float8& a, const Float8& b) { return Float8(_mm256_min_ps(a.m_v, b.m_v)); }
+inline Float8 vmax(const Float8& a, const Float8& b) { return Float8(_mm256_max_ps(a.m_v, b.m_v)); }
+inline Float8 sqrt(const Float8& a) { return Float8(_mm256_sqrt_ps(a.m_v)); }
+inline Float8 abs(const Float8& a) { return Float8(_mm256_andnot_ps(_mm256_set1_ps(-0.f), a.m_v)); }
+
+// Ordered comparisons, false with NaNs
+inline Bool8 operator<(const Float8& a, const Float8& b) { return Bool8(_mm256_cmp_ps(a.m_v, b.m_v, _CMP_LT_OQ)); }
+inline Bool8 operator<=(const Float8& a, const Float8& b) { return Bool8(_mm256_cmp_ps(a.m_v, b.m_v, _CMP_LE_OQ)); }
+inline Bool8 operator>(const Float8& a, const Float8& b) { return Bool8(_mm256_cmp_ps(a.m_v, b.m_v, _CMP_GT_OQ)); }
+inline Bool8 operator>=(const Float8& a, const Float8& b) { return Bool8(_mm256_cmp_ps(a.m_v, b.m_v, _CMP_GE_OQ)); }
+inline Bool8 operator==(const Float8& a, const Float8& b) { return Bool8(_mm256_cmp_ps(a.m_v, b.m_v, _CMP_EQ_OQ)); }
+inline Bool8 operator&(const Bool8& a, const Bool8& b) { return Bool8(_mm256_and_ps(a.m_v, b.m_v)); }
+inline Bool8 operator|(const Bool8& a, const Bool8& b) { return Bool8(_mm256_or_ps(a.m_v, b.m_v)); }
+// Bit i is set if lane i is true
+inline int movemask(const Bool8& a) { return _mm256_movemask_ps(a.m_v); }
+// mask ? a : b per lane
+inline Float8 select(const Bool8& mask, const Float8& a, const Float8& b) { return Float8(_mm256_blendv_ps(b.m_v, a.m_v, mask.m_v)); }
+#else
+inline Float8 operator+(const Float8& a, const Float8& b) { Float8 r; for (int lane = 0; lane < 8; lane++) r.m_p[lane] = a[lane] + b[lane]; return r; }
+inline Float8 operator-(const Float8& a, const Float8& b) { Float8 r; for (int lane = 0; lane < 8; lane++) r.m_p[lane] = a[lane] - b[lane]; return r; }
+inline Float8 operator*(const Float8& a, const Float8& b) { Float8 r; for (int lane = 0; lane < 8; lane++) r.m_p[lane] = a[lane] * b[lane]; return r; }
+inline Float8 operator/(const Float8& a, const Float8& b) { Float8 r; for (int lane = 0; lane < 8; lane++) r.m_p[lane] = a[lane] / b[lane]; return r; }
+inline Float8 operator-(const Float8& a) { Float8 r; for (int lane = 0; lane < 8; lane++) r.m_p[lane] = -a[lane]; return r; }
+inline Float8 vmin(const Float8& a, const Float8& b) { Float8 r; for (int lane = 0; lane < 8; lane++) r.m_p[lane] = a[lane] < b[lane] ? a[lane] : b[lane]; return r; }
+inline Float8 vmax(const Float8& a, const Float8& b) { Float8 r; for (int lane = 0; lane < 8; lane++) r.m_p[lane] = a[lane] > b[lane] ? a[lane] : b[lane]; return r; }
+inline Float8 sqrt(const Float8& a) { Float8 r; for (int lane = 0; lane < 8; lane++) r.m_p[lane] = std::sqrt(a[lane]); return r; }
+inline Float8 abs(const Float8& a) { Float8 r; for (int lane = 0; lane < 8; lane++) r.m_p[lane] = std::abs(a[lane]); return r; }
+
+// Ordered comparisons, false with NaNs
+inline Bool8 operator<(const Float8& a, const Float8& b) { Bool8 r; for (int lane = 0; lane < 8; lane++) r.m_v[lane] = a[lane] < b[lane]; return r; }
+inline Bool8 operator<=(const Float8& a, const Float8& b) { Bool8 r; for (int lane = 0; lane < 8; lane++) r.m_v[lane] = a[lane] <= b[lane]; return r; }
+inline Bool8 operator>(const Float8& a, const Float8& b) { Bool8 r; for (int lane = 0; lane < 8; lane++) r.m_v[lane] = a[lane] > b[lane]; return r; }
+inline Bool8 operator>=(const Float8& a, const Float8& b) { Bool8 r; for (int lane = 0; lane < 8; lane++) r.m_v[lane] = a[lane] >= b[lane]; return r; }
+inline Bool8 operator==(const Float8& a, const Float8& b) { Bool8 r; for (int lane = 0; lane < 8; lane++) r.m_v[lane] = a[lane] == b[lane]; return r; }
+inline Bool8 operator&(const Bool8& a, const Bool8& b) { Bool8 r; for (int lane = 0; lane < 8; lane++) r.m_v[lane] = a.m_v[lane] && b.m_v[lane]; return r; }
+inline Bool8 operator|(const Bool8& a, const Bool8& b) { Bool8 r; for (int lane = 0; lane < 8; lane++) r.m_v[lane] = a.m_v[lane] || b.m_v[lane]; return r; }
+// Bit i is set if lane i is true
+inline int movemask(const Bool8& a) { int mask = 0; for (int lane = 0; lane < 8; lane++) mask |= a.m_v[lane] ? 1 << lane : 0; return mask; }
+// mask ? a : b per lane
+inline Float8 select(const Bool8& mask, const Float8& a, const Float8& b) { Float8 r; for (int lane = 0; lane < 8; lane++) r.m_p[lane] = mask.m_v[lane] ? a[lane] : b[lane]; return r; }
+#endif
+
+/// <summary>
+/// 8 vectors as structure of arrays, one Float8 per axis
+/// </summary>
+struct Vec3x8
+{
+	Float8 m_p[3];
+
+	inline Vec3x8() {}
+	inline Vec3x8(const Float8& x, const Float8& y, const Float8& z) { m_p[0] = x; m_p[1] = y; m_p[2] = z; }
+	// The same vector in all the lanes
+	inline explicit Vec3x8(const Vec3f& v) : Vec3x8(Float8(v[0]), Float8(v[1]), Float8(v[2])) {}
+
+	// From and to arrays laid out as p[axis][lane]
+	static inline Vec3x8 load(const float (&p)[3][8]) { return Vec3x8(Float8::load(p[0]), Float8::load(p[1]), Float8::load(p[2])); }
+	inline void store(float (&p)[3][8]) const { for (int axis = 0; axis < 3; axis++) m_p[axis].store(p[axis]); }
+
+	inline Float8& operator[](int axis) { return m_p[axis]; }
+	inline const Float8& operator[](int axis) const { return m_p[axis]; }
+	inline Vec3f lane(int lane) const { return Vec3f(m_p[0][lane], m_p[1][lane], m_p[2][lane]); }
+};
+
+inline Vec3x8 operator+(const Vec3x8& a, const Vec3x8& b) { return Vec3x8(a[0] + b[0], a[1] + b[1], a[2] + b[2]); }
+inline Vec3x8 operator-(const Vec3x8& a, const Vec3x8& b) { return Vec3x8(a[0] - b[0], a[1] - b[1], a[2] - b[2]); }
+inline Vec3x8 operator*(const Vec3x8& a, const Vec3x8& b) { return Vec3x8(a[0] * b[0], a[1] * b[1], a[2] * b[2]); }
+inline Vec3x8 operator/(const Vec3x8& a, const Vec3x8& b) { return Vec3x8(a[0] / b[0], a[1] / b[1], a[2] / b[2]); }
+inline Vec3x8 operator*(const Vec3x8& a, const Float8& s) { return Vec3x8(a[0] * s, a[1] * s, a[2] * s); }
+inline Vec3x8 operator*(const Float8& s, const Vec3x8& a) { return a * s; }
+inline Vec3x8 operator/(const Vec3x8& a, const Float8& s) { return Vec3x8(a[0] / s, a[1] / s, a[2] / s); }
+inline Vec3x8 operator-(const Vec3x8& a) { return Vec3x8(-a[0], -a[1], -a[2]); }
+
+inline Float8 dot(const Vec3x8& a, const Vec3x8& b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+
+inline Vec3x8 cross(const Vec3x8& a, const Vec3x8& b)
+{
+	return Vec3x8(a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]);
+}
+
+inline Float8 length(const Vec3x8& a) { return sqrt(dot(a, a)); }
+
+// Zero vectors are left unchanged like Vec3f::normalize
+inline Vec3x8 normalize(const Vec3x8& a)
+{
+	Float8 l = length(a);
+	Bool8 zero = l == Float8(0.f);
+	Vec3x8 n = a * (Float8(1.f) / l);
+	return Vec3x8(select(zero, a[0], n[0]), select(zero, a[1], n[1]), select(zero, a[2], n[2]));
+}
+
+inline Vec3x8 mix(const Vec3x8& u, const Vec3x8& v, const Float8& alpha) { return u * (Float8(1.f) - alpha) + v * alpha; }
+
+inline Vec3x8 select(const Bool8& mask, const Vec3x8& a, const Vec3x8& b)
+{
+	return Vec3x8(select(mask, a[0], b[0]), select(mask, a[1], b[1]), select(mask, a[2], b[2]));
+}
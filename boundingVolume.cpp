@@ -1,39 +1,24 @@
 #include "boundingVolume.h"
 
-bool AABB::hit(Ray ray, float& tmin, float& tmax) const
+bool AABB::hit(const Ray& ray, float& tmin, float& tmax) const
 {
-	tmin = std::numeric_limits<float>().min();
-	tmax = std::numeric_limits<float>().max();
-	//look for both intersections time in each direction
+	const Vec3f* corners[2] = { &m_minCorner, &m_maxCorner };
+	tmin = ray.m_tMin;
+	tmax = ray.m_tMax;
+	//look for both intersections time in each direction, the ray sign gives the near corner
 	for (int i = 0; i < 3; i++)
 	{
-		float invD = 1.0f / (float)ray.m_direction[i];
-		float t0 = (m_minCorner[i] - ray.m_origin[i]) * invD;
-		float t1 = (m_maxCorner[i] - ray.m_origin[i]) * invD;
-		//swap order if ray goes in negative direction
-		if (invD < 0) { std::swap(t0, t1); } 
+		float t0 = ((*corners[ray.m_sign[i]])[i] - ray.m_origin[i]) * ray.m_invDirection[i];
+		float t1 = ((*corners[1 - ray.m_sign[i]])[i] - ray.m_origin[i]) * ray.m_invDirection[i];
 		tmin = t0 > tmin ? t0 : tmin;
 		tmax = t1 < tmax ? t1 : tmax;
-		if (tmax <= tmin) return false;
+		if (tmax < tmin) return false;
 	}
 	return true;
 }
 
-bool AABB::hit(Ray ray) const
+bool AABB::hit(const Ray& ray) const
 {
-	float tmin = std::numeric_limits<float>().min();
-	float tmax = std::numeric_limits<float>().max();
-	//look for both intersections time in each direction
-	for (int i = 0; i < 3; i++)
-	{
-		float invD = 1.0f / (float)ray.m_direction[i];
-		float t0 = (m_minCorner[i] - ray.m_origin[i]) * invD;
-		float t1 = (m_maxCorner[i] - ray.m_origin[i]) * invD;
-		//swap order if ray goes in negative direction
-		if (invD < 0) { std::swap(t0, t1); }
-		tmin = t0 > tmin ? t0 : tmin;
-		tmax = t1 < tmax ? t1 : tmax;
-		if (tmax <= tmin) return false;
-	}
-	return true;
+	float tmin, tmax;
+	return hit(ray, tmin, tmax);
 }
\ No newline at end of file
@@ -28,8 +28,21 @@ public:
 			if (m_maxCorner[k] < pos[k]) m_maxCorner[k] = pos[k];
 		}
 	}
-	bool hit(Ray ray, float& tmin, float& tmax) const;
-	bool hit(Ray ray) const;
+	inline void compareAndUpdate(const AABB& box)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			if (m_minCorner[k] > box.m_minCorner[k]) m_minCorner[k] = box.m_minCorner[k];
+			if (m_maxCorner[k] < box.m_maxCorner[k]) m_maxCorner[k] = box.m_maxCorner[k];
+		}
+	}
+	inline float surfaceArea() const
+	{
+		Vec3f diff = m_maxCorner - m_minCorner;
+		return 2.f * (diff[0] * diff[1] + diff[1] * diff[2] + diff[2] * diff[0]);
+	}
+	bool hit(const Ray& ray, float& tmin, float& tmax) const;
+	bool hit(const Ray& ray) const;
 	inline bool contains(const Vec3f& position) const
 	{
 		if (m_minCorner[0] <= position[0] && position[0] <= m_maxCorner[0] 
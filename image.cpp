@@ -1,4 +1,6 @@
 #include "image.h"
+#include <limits>
+#include <algorithm>
 
 //CONSTRUCTORS
 
@@ -21,8 +23,40 @@ void Image::setColorValue(size_t i, size_t j, Vec3f newColorValue)
     colors[i * width + j] = newColorValue;
 }
 
+void Image::clearAccumulation()
+{
+    accumulation.assign(width * height, Vec3d(0.0, 0.0, 0.0));
+    sampleCounts.assign(width * height, 0);
+    luminanceSquares.assign(width * height, 0.0);
+}
+
 //IMAGE FUNCTIONS
 
+void Image::resolve()
+{
+    #pragma omp parallel for
+    for (int i = 0; i < int(accumulation.size()); i++)
+    {
+        if (sampleCounts[i] == 0) continue;
+        Vec3d mean = accumulation[i] / double(sampleCounts[i]);
+        colors[i] = Vec3f(float(mean[0]), float(mean[1]), float(mean[2]));
+    }
+}
+
+float Image::pixelError(size_t i, size_t j) const
+{
+    size_t index = j * width + i;
+    double n = double(sampleCounts[index]);
+    if (n < 2) return std::numeric_limits<float>::max();
+    const Vec3d& sum = accumulation[index];
+    double mean = (0.2126 * sum[0] + 0.7152 * sum[1] + 0.0722 * sum[2]) / n;
+    // Unbiased sample variance, divided by n for the variance of the mean
+    double variance = std::max(0.0, (luminanceSquares[index] - n * mean * mean) / (n - 1));
+    // Relative to the square root of the mean : noise in dark areas is less visible than in bright ones,
+    // but not as much less as a plain relative error would say
+    return float(std::sqrt(variance / n) / std::sqrt(std::max(mean, 0.0001)));
+}
+
 Image::Image(Vec3f colorValue, size_t _width=64, size_t _height=64)
 {
 	width = _width;
@@ -73,6 +107,36 @@ void Image::savePNG(const char* file_path)
     pixel_buffer.clear();
 }
 
+void Image::saveSampleCountPNG(const char* file_path) const
+{
+    uint32_t minCount = std::numeric_limits<uint32_t>::max(), maxCount = 0;
+    for (uint32_t count : sampleCounts)
+    {
+        minCount = std::min(minCount, count);
+        maxCount = std::max(maxCount, count);
+    }
+    double range = maxCount > minCount ? double(maxCount - minCount) : 1.0;
+
+    std::vector<unsigned char> pixel_buffer;
+    pixel_buffer.reserve(width * height * 4);
+    for (uint32_t count : sampleCounts)
+    {
+        // Blue -> cyan -> green -> yellow -> red ramp
+        double t = (count - minCount) / range;
+        double r = clamp(std::min(4.0 * t - 2.0, 1.0));
+        double g = clamp(t < 0.75 ? 4.0 * t : 4.0 - 4.0 * t);
+        double b = clamp(2.0 - 4.0 * t);
+        pixel_buffer.push_back(toInt(r));
+        pixel_buffer.push_back(toInt(g));
+        pixel_buffer.push_back(toInt(b));
+        pixel_buffer.push_back(255);
+    }
+
+    unsigned error = lodepng::encode(file_path, pixel_buffer, width, height);
+    if (error) std::cout << "encoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+    else std::cout << "-Sample count heat map : " << minCount << " to " << maxCount << " samples per pixel" << std::endl;
+}
+
 void Image::fillBackground(Vec3f from, Vec3f to)
 {
     for (int j = 0; j < height; j++)
@@ -6,6 +6,7 @@
 #include<fstream>
 #include<string>
 #include <omp.h>
+#include <cstdint>
 
 class Image
 {
@@ -13,6 +14,11 @@ class Image
 		size_t width =0;
 		size_t height = 0;
 		std::vector<Vec3f> colors;
+		// Progressive rendering : sum of the samples and number of samples of each pixel
+		std::vector<Vec3d> accumulation;
+		std::vector<uint32_t> sampleCounts;
+		// Adaptive sampling : sum of the squared sample luminances, for the per pixel variance
+		std::vector<double> luminanceSquares;
 
 	public:
 		Image(size_t _width, size_t _height);
@@ -25,6 +31,21 @@ class Image
 		void fillBackground(Vec3f from, Vec3f to);
 		void setColors(std::vector<Vec3f> colors);
 		void setColorValue(size_t i, size_t j, Vec3f colorValue);
+		void clearAccumulation();
+		inline void accumulate(size_t i, size_t j, const Vec3f& sampleSum, double luminanceSquareSum, uint32_t sampleCount)
+		{
+			accumulation[j * width + i] += Vec3d(sampleSum[0], sampleSum[1], sampleSum[2]);
+			luminanceSquares[j * width + i] += luminanceSquareSum;
+			sampleCounts[j * width + i] += sampleCount;
+		}
+		inline uint32_t sampleCount(size_t i, size_t j) const { return sampleCounts[j * width + i]; }
+		static inline float luminance(const Vec3f& color) { return 0.2126f * color[0] + 0.7152f * color[1] + 0.0722f * color[2]; }
+		// Standard error of the mean luminance of a pixel, relative to the square root of that mean
+		float pixelError(size_t i, size_t j) const;
+		// Debug view of the number of samples of each pixel, from blue (fewest) to red (most)
+		void saveSampleCountPNG(const char* file_path) const;
+		// Write the mean of the accumulated samples to the colors, pixels without samples are left unchanged
+		void resolve();
 		inline const Vec3f& operator() (size_t i, size_t j) const { return colors[j * width + i]; }
 		inline Vec3f& operator() (size_t i, size_t j) { return colors[j * width + i]; }
 };
@@ -0,0 +1,296 @@
+#include "lightBVH.h"
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+	const int kBinCount = 12;
+	const float kOneMinusEpsilon = 0.99999994f;
+
+	inline float safeSqrt(float x) { return std::sqrt(std::max(0.f, x)); }
+
+	// Rotation of v by angle around the unit axis k, v orthogonal to k
+	inline Vec3f rotate(const Vec3f& v, const Vec3f& k, float angle)
+	{
+		return std::cos(angle) * v + std::sin(angle) * cross(k, v);
+	}
+
+	// Smallest cone holding the normal cones a and b
+	void unionCones(const Vec3f& axisA, float cosA, const Vec3f& axisB, float cosB, Vec3f& axis, float& cosTheta)
+	{
+		axis = axisA;
+		cosTheta = -1.f;
+		if (cosA == -1.f || cosB == -1.f) return;
+		float thetaA = std::acos(std::min(1.f, std::max(-1.f, cosA)));
+		float thetaB = std::acos(std::min(1.f, std::max(-1.f, cosB)));
+		float thetaD = std::acos(std::min(1.f, std::max(-1.f, dot(axisA, axisB))));
+		if (std::min(thetaD + thetaB, float(M_PI)) <= thetaA)
+		{
+			cosTheta = cosA;
+			return;
+		}
+		if (std::min(thetaD + thetaA, float(M_PI)) <= thetaB)
+		{
+			axis = axisB;
+			cosTheta = cosB;
+			return;
+		}
+		float thetaO = 0.5f * (thetaA + thetaD + thetaB);
+		if (thetaO >= float(M_PI)) return;
+		Vec3f rotationAxis = cross(axisA, axisB);
+		if (rotationAxis.squaredLength() == 0.f) return;
+		axis = normalize(rotate(axisA, normalize(rotationAxis), thetaO - thetaA));
+		cosTheta = std::cos(thetaO);
+	}
+
+	void merge(LightBounds& node, const LightBounds& other)
+	{
+		if (other.m_power <= 0.f) return;
+		if (node.m_power <= 0.f)
+		{
+			node = other;
+			return;
+		}
+		node.m_bounds.compareAndUpdate(other.m_bounds);
+		// Emitters are two sided, the other cone is flipped when that makes the union tighter
+		Vec3f otherAxis = dot(node.m_axis, other.m_axis) < 0.f ? -other.m_axis : other.m_axis;
+		unionCones(node.m_axis, node.m_cosTheta, otherAxis, other.m_cosTheta, node.m_axis, node.m_cosTheta);
+		node.m_power += other.m_power;
+	}
+
+	// Orientation measure of a cone of normals of half angle thetaO, for emitters spreading over a hemisphere
+	inline float orientationMeasure(float cosTheta)
+	{
+		float thetaO = std::acos(std::min(1.f, std::max(-1.f, cosTheta)));
+		float thetaW = std::min(thetaO + float(M_PI) / 2.f, float(M_PI));
+		float sinThetaO = safeSqrt(1.f - cosTheta * cosTheta);
+		return 2.f * float(M_PI) * (1.f - cosTheta) + float(M_PI) / 2.f * (2.f * thetaW * sinThetaO - std::cos(thetaO - 2.f * thetaW) - 2.f * thetaO * sinThetaO + cosTheta);
+	}
+
+	// Surface area orientation heuristic of the paper, kr penalizes thin boxes cut across their small side
+	inline float splitCost(const LightBounds& node, float kr)
+	{
+		if (node.m_power <= 0.f) return 0.f;
+		return node.m_power * orientationMeasure(node.m_cosTheta) * kr * node.m_bounds.surfaceArea();
+	}
+}
+
+LightBVH::LightBVH(const std::vector<Mesh>& meshes, const std::vector<MaterialData>& materials, const std::vector<MaterialId>& materialIds)
+{
+	std::vector<BuildPrimitive> primitives;
+	m_meshOffsets.assign(meshes.size(), -1);
+	for (size_t m = 0; m < meshes.size(); m++)
+	{
+		const Mesh& mesh = meshes[m];
+		const MaterialData& material = materials[materialIds[m]];
+		if (material.type != Material::EMISSIVE) continue;
+		m_meshOffsets[m] = int(m_leaves.size());
+		m_leaves.resize(m_leaves.size() + mesh.indices().size(), -1);
+		float emitted = LightSampler::emittedLuminance(material);
+		for (size_t t = 0; t < mesh.indices().size(); t++)
+		{
+			Vec3<Vec3f> triangle = mesh.triangle(mesh.indices()[t]);
+			float area = GeometryHelper::computeTriangleArea(triangle);
+			float power = area * emitted;
+			if (!(power > 0.f)) continue;
+			BuildPrimitive primitive;
+			primitive.bounds.m_bounds = AABB(std::vector<Vec3f>{ triangle[0], triangle[1], triangle[2] });
+			primitive.bounds.m_axis = GeometryHelper::computeTriangleNormal(triangle);
+			primitive.bounds.m_cosTheta = 1.f;
+			primitive.bounds.m_power = power;
+			primitive.centroid = (triangle[0] + triangle[1] + triangle[2]) / 3.f;
+			primitive.triangle = uint32_t(m_triangles.size());
+			primitives.push_back(primitive);
+			m_triangles.push_back({ uint32_t(m), uint32_t(t), area });
+		}
+	}
+	if (primitives.empty()) return;
+	m_nodes.reserve(2 * primitives.size() - 1);
+	m_parents.reserve(2 * primitives.size() - 1);
+	build(primitives, 0, int(primitives.size()), -1);
+}
+
+int LightBVH::build(std::vector<BuildPrimitive>& primitives, int begin, int end, int parent)
+{
+	int nodeIndex = int(m_nodes.size());
+	m_nodes.push_back(LightNode());
+	m_parents.push_back(parent);
+	LightBounds bounds;
+	AABB centroidBounds;
+	for (int i = begin; i < end; i++)
+	{
+		merge(bounds, primitives[i].bounds);
+		centroidBounds.compareAndUpdate(primitives[i].centroid);
+	}
+	LightNode node;
+	node.m_center = 0.5f * (bounds.m_bounds.min() + bounds.m_bounds.max());
+	node.m_radius = 0.5f * (bounds.m_bounds.max() - bounds.m_bounds.min()).length();
+	node.m_axis = bounds.m_axis;
+	node.m_cosTheta = bounds.m_cosTheta;
+	node.m_sinTheta = safeSqrt(1.f - bounds.m_cosTheta * bounds.m_cosTheta);
+	node.m_power = bounds.m_power;
+	if (end - begin == 1)
+	{
+		node.m_leaf = true;
+		node.m_offset = int32_t(primitives[begin].triangle);
+		const EmissiveTriangle& emissive = m_triangles[node.m_offset];
+		m_leaves[m_meshOffsets[emissive.mesh] + emissive.triangle] = nodeIndex;
+		m_nodes[nodeIndex] = node;
+		return nodeIndex;
+	}
+
+	// Binned split minimizing the surface area orientation cost, over the three axes
+	Vec3f extent = bounds.m_bounds.max() - bounds.m_bounds.min();
+	float maxExtent = std::max(extent[0], std::max(extent[1], extent[2]));
+	Vec3f centroidExtent = centroidBounds.max() - centroidBounds.min();
+	float bestCost = std::numeric_limits<float>::max();
+	int bestAxis = -1, bestBin = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (centroidExtent[axis] <= 0.f) continue;
+		LightBounds bins[kBinCount];
+		for (int i = begin; i < end; i++)
+		{
+			int bin = std::min(kBinCount - 1, int(kBinCount * (primitives[i].centroid[axis] - centroidBounds.min()[axis]) / centroidExtent[axis]));
+			merge(bins[bin], primitives[i].bounds);
+		}
+		float kr = extent[axis] > 0.f ? maxExtent / extent[axis] : 1.f;
+		// Sweep from the right to get the cost of every right side, then from the left
+		float rightCosts[kBinCount];
+		bool rightEmpty[kBinCount];
+		LightBounds right;
+		for (int b = kBinCount - 1; b > 0; b--)
+		{
+			merge(right, bins[b]);
+			rightCosts[b] = splitCost(right, kr);
+			rightEmpty[b] = right.m_power <= 0.f;
+		}
+		LightBounds left;
+		for (int b = 0; b < kBinCount - 1; b++)
+		{
+			merge(left, bins[b]);
+			float cost = splitCost(left, kr) + rightCosts[b + 1];
+			if (left.m_power > 0.f && !rightEmpty[b + 1] && cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = b;
+			}
+		}
+	}
+
+	int mid = (begin + end) / 2;
+	if (bestAxis >= 0)
+	{
+		auto split = std::partition(primitives.begin() + begin, primitives.begin() + end, [&](const BuildPrimitive& primitive)
+		{
+			int bin = std::min(kBinCount - 1, int(kBinCount * (primitive.centroid[bestAxis] - centroidBounds.min()[bestAxis]) / centroidExtent[bestAxis]));
+			return bin <= bestBin;
+		});
+		mid = int(split - primitives.begin());
+	}
+	// Stacked lights or an empty side : split the range in two halves
+	if (mid == begin || mid == end) mid = (begin + end) / 2;
+
+	build(primitives, begin, mid, nodeIndex);
+	node.m_offset = build(primitives, mid, end, nodeIndex);
+	m_nodes[nodeIndex] = node;
+	return nodeIndex;
+}
+
+float LightBVH::importance(const LightNode& node, const Vec3f& position, const Vec3f& normal)
+{
+	// Distance to the center, clamped so that the importance stays bounded near and inside the node
+	Vec3f toPosition = position - node.m_center;
+	float squaredDistance = toPosition.squaredLength();
+	float clampedDistance = std::max(squaredDistance, node.m_radius);
+	float squaredRadius = node.m_radius * node.m_radius;
+	if (squaredDistance <= squaredRadius)
+	{
+		// The bounding sphere of the node holds the shading point, every direction is possible
+		return node.m_power / clampedDistance;
+	}
+	float inverseDistance = 1.f / std::sqrt(squaredDistance);
+	Vec3f direction = toPosition * inverseDistance;
+
+	// Angle subtended by the bounding sphere
+	float sinThetaB = node.m_radius * inverseDistance;
+	float cosThetaB = safeSqrt(1.f - sinThetaB * sinThetaB);
+
+	// Smallest angle between the emitters normals (both sides) and the direction to the shading point
+	float cosThetaW = std::abs(dot(node.m_axis, direction));
+	float cosThetaX = 1.f, sinThetaX = 0.f;
+	if (cosThetaW < node.m_cosTheta)
+	{
+		float sinThetaW = safeSqrt(1.f - cosThetaW * cosThetaW);
+		cosThetaX = cosThetaW * node.m_cosTheta + sinThetaW * node.m_sinTheta;
+		sinThetaX = sinThetaW * node.m_cosTheta - cosThetaW * node.m_sinTheta;
+	}
+	float cosThetaP = cosThetaX >= cosThetaB ? 1.f : cosThetaX * cosThetaB + sinThetaX * sinThetaB;
+	if (cosThetaP <= 0.f) return 0.f;
+
+	// Lights below the tangent plane of the shading point can't contribute
+	float cosThetaI = -dot(direction, normal);
+	if (cosThetaI < cosThetaB) cosThetaI = cosThetaI * cosThetaB + safeSqrt(1.f - cosThetaI * cosThetaI) * sinThetaB;
+	else cosThetaI = 1.f;
+	if (cosThetaI <= 0.f) return 0.f;
+	return node.m_power * cosThetaP * cosThetaI / clampedDistance;
+}
+
+bool LightBVH::sample(const std::vector<Mesh>& meshes, const Vec3f& position, const Vec3f& normal, float u, float r1, float r2, EmissiveSample& sample) const
+{
+	if (m_nodes.empty()) return false;
+
+	// Walk down the tree, u is rescaled at each choice so that it stays uniform
+	float pmf = 1.f;
+	int nodeIndex = 0;
+	while (!m_nodes[nodeIndex].m_leaf)
+	{
+		int first = nodeIndex + 1, second = m_nodes[nodeIndex].m_offset;
+		float firstImportance = importance(m_nodes[first], position, normal);
+		float secondImportance = importance(m_nodes[second], position, normal);
+		if (firstImportance + secondImportance <= 0.f) return false;
+		float firstProbability = firstImportance / (firstImportance + secondImportance);
+		if (u < firstProbability)
+		{
+			nodeIndex = first;
+			pmf *= firstProbability;
+			u = std::min(u / firstProbability, kOneMinusEpsilon);
+		}
+		else
+		{
+			nodeIndex = second;
+			pmf *= 1.f - firstProbability;
+			u = std::min((u - firstProbability) / (1.f - firstProbability), kOneMinusEpsilon);
+		}
+	}
+
+	const EmissiveTriangle& emissive = m_triangles[m_nodes[nodeIndex].m_offset];
+	const Mesh& mesh = meshes[emissive.mesh];
+	Vec3<Vec3f> triangle = mesh.triangle(mesh.indices()[emissive.triangle]);
+	sample.position = GeometryHelper::sampleTriangleUniformly(triangle, r1, r2);
+	sample.normal = GeometryHelper::computeTriangleNormal(triangle);
+	sample.meshIndex = emissive.mesh;
+	sample.pdfArea = pmf / emissive.area;
+	return true;
+}
+
+float LightBVH::pmf(const Vec3f& position, const Vec3f& normal, size_t meshIndex, int triangle) const
+{
+	if (meshIndex >= m_meshOffsets.size() || m_meshOffsets[meshIndex] < 0 || triangle < 0) return 0.f;
+	int nodeIndex = m_leaves[m_meshOffsets[meshIndex] + triangle];
+	if (nodeIndex < 0) return 0.f;
+
+	// Product of the child probabilities of sample(), from the leaf up to the root
+	float pmf = 1.f;
+	while (m_parents[nodeIndex] >= 0)
+	{
+		int parent = m_parents[nodeIndex];
+		int sibling = nodeIndex == parent + 1 ? m_nodes[parent].m_offset : parent + 1;
+		float nodeImportance = importance(m_nodes[nodeIndex], position, normal);
+		if (nodeImportance <= 0.f) return 0.f;
+		pmf *= nodeImportance / (nodeImportance + importance(m_nodes[sibling], position, normal));
+		nodeIndex = parent;
+	}
+	return pmf;
+}
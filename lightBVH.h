@@ -0,0 +1,80 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "Vec3.h"
+#include "mesh.h"
+#include "lightSampler.h"
+
+// Position, normals and power of a set of emitters
+struct LightBounds
+{
+	AABB m_bounds;
+	Vec3f m_axis;                                        // emitters normals are within acos(m_cosTheta) of the axis, up to their sign
+	float m_cosTheta = 1.f;
+	float m_power = 0.f;
+};
+
+// Node of the light BVH. Nodes are stored in depth-first order like BVHnode : the first child of an
+// interior node is the next node, m_offset is the index of the second child, or of the emissive triangle for a leaf.
+// The box of the bounds is replaced by its bounding sphere, which is all the traversal needs.
+struct LightNode
+{
+	Vec3f m_center;
+	float m_radius = 0.f;
+	Vec3f m_axis;
+	float m_cosTheta = 1.f;
+	float m_sinTheta = 0.f;
+	float m_power = 0.f;
+	int32_t m_offset = -1;
+	bool m_leaf = false;
+};
+
+/// <summary>
+/// Light hierarchy over the emissive triangles for many-light sampling (Conty Estevez and Kulla 2018,
+/// "Importance Sampling of Many Lights with Adaptive Tree Splitting"). Each node bounds the position, the normals
+/// and the power of its lights. A light is picked by walking down the tree from the root : at each node a child is
+/// chosen proportionally to a conservative estimate of its contribution to the shading point, so the cost is
+/// logarithmic in the number of lights and distant or back facing lights are rarely sampled.
+/// Lights emit on both sides, like in RayTracer::sampleEmissive.
+/// </summary>
+class LightBVH
+{
+	public:
+		LightBVH() {}
+		// Materials of the meshes in the material table of the scene, see Scene::material
+		LightBVH(const std::vector<Mesh>& meshes, const std::vector<MaterialData>& materials, const std::vector<MaterialId>& materialIds);
+
+		inline bool empty() const { return m_nodes.empty(); }
+		inline const std::vector<LightNode>& nodes() const { return m_nodes; }
+
+		// Samples an emissive triangle for the shading point with u, then a uniform point on it with (r1, r2).
+		// False without lights or if no light can reach the shading point
+		bool sample(const std::vector<Mesh>& meshes, const Vec3f& position, const Vec3f& normal, float u, float r1, float r2, EmissiveSample& sample) const;
+		// Probability of sample() picking the triangle of the mesh from the shading point, for multiple importance sampling
+		float pmf(const Vec3f& position, const Vec3f& normal, size_t meshIndex, int triangle) const;
+
+	private:
+		struct EmissiveTriangle
+		{
+			uint32_t mesh;
+			uint32_t triangle;
+			float area;
+		};
+
+		struct BuildPrimitive
+		{
+			LightBounds bounds;
+			Vec3f centroid;
+			uint32_t triangle;
+		};
+
+		int build(std::vector<BuildPrimitive>& primitives, int begin, int end, int parent);
+		static float importance(const LightNode& node, const Vec3f& position, const Vec3f& normal);
+
+		std::vector<LightNode> m_nodes;
+		std::vector<int> m_parents;
+		std::vector<EmissiveTriangle> m_triangles;
+		// Leaf of each triangle of the emissive meshes : m_leaves[m_meshOffsets[mesh] + triangle], -1 if it isn't a light
+		std::vector<int> m_meshOffsets;
+		std::vector<int> m_leaves;
+};
@@ -0,0 +1,79 @@
+#include "lightSampler.h"
+#include <algorithm>
+
+LightSampler::LightSampler(const std::vector<Mesh>& meshes, const std::vector<MaterialData>& materials, const std::vector<MaterialId>& materialIds)
+{
+	// Triangles that can't emit anything are left out of the table
+	std::vector<double> weights;
+	double totalWeight = 0.0;
+	for (size_t m = 0; m < meshes.size(); m++)
+	{
+		const Mesh& mesh = meshes[m];
+		const MaterialData& material = materials[materialIds[m]];
+		if (material.type != Material::EMISSIVE) continue;
+		float emitted = emittedLuminance(material);
+		for (size_t t = 0; t < mesh.indices().size(); t++)
+		{
+			double weight = double(GeometryHelper::computeTriangleArea(mesh.triangle(mesh.indices()[t]))) * emitted;
+			if (!(weight > 0.0)) continue;
+			m_triangles.push_back({ uint32_t(m), uint32_t(t) });
+			weights.push_back(weight);
+			totalWeight += weight;
+		}
+	}
+	size_t count = m_triangles.size();
+	m_totalWeight = float(totalWeight);
+	m_threshold.assign(count, 1.f);
+	m_alias.resize(count);
+	m_pdfArea.resize(count);
+	if (count == 0) return;
+
+	// Vose's method : bins under the average are topped up by one bin over it, which becomes their alias
+	std::vector<double> scaled(count);
+	std::vector<uint32_t> underfull, overfull;
+	for (size_t i = 0; i < count; i++)
+	{
+		const EmissiveTriangle& emissive = m_triangles[i];
+		const Mesh& mesh = meshes[emissive.mesh];
+		m_pdfArea[i] = float(weights[i] / totalWeight) / GeometryHelper::computeTriangleArea(mesh.triangle(mesh.indices()[emissive.triangle]));
+		m_alias[i] = uint32_t(i);
+		scaled[i] = weights[i] * count / totalWeight;
+		if (scaled[i] < 1.0) underfull.push_back(uint32_t(i));
+		else overfull.push_back(uint32_t(i));
+	}
+	while (!underfull.empty() && !overfull.empty())
+	{
+		uint32_t under = underfull.back(); underfull.pop_back();
+		uint32_t over = overfull.back();
+		m_threshold[under] = float(scaled[under]);
+		m_alias[under] = over;
+		scaled[over] -= 1.0 - scaled[under];
+		if (scaled[over] < 1.0)
+		{
+			overfull.pop_back();
+			underfull.push_back(over);
+		}
+	}
+	// Whatever is left is 1 up to rounding errors
+	for (uint32_t i : underfull) m_threshold[i] = 1.f;
+	for (uint32_t i : overfull) m_threshold[i] = 1.f;
+}
+
+bool LightSampler::sample(const std::vector<Mesh>& meshes, float u, float r1, float r2, EmissiveSample& sample) const
+{
+	if (m_triangles.empty()) return false;
+
+	// The integer part of u picks the bin, the fractional part chooses between the bin and its alias
+	float scaled = u * float(m_triangles.size());
+	size_t bin = std::min(m_triangles.size() - 1, size_t(scaled));
+	size_t index = (scaled - float(bin)) < m_threshold[bin] ? bin : m_alias[bin];
+
+	const EmissiveTriangle& emissive = m_triangles[index];
+	const Mesh& mesh = meshes[emissive.mesh];
+	Vec3<Vec3f> triangle = mesh.triangle(mesh.indices()[emissive.triangle]);
+	sample.position = GeometryHelper::sampleTriangleUniformly(triangle, r1, r2);
+	sample.normal = GeometryHelper::computeTriangleNormal(triangle);
+	sample.meshIndex = emissive.mesh;
+	sample.pdfArea = m_pdfArea[index];
+	return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "Vec3.h"
+#include "mesh.h"
+
+// Point sampled on an emissive triangle
+struct EmissiveSample
+{
+	Vec3f position;
+	Vec3f normal;                                        // geometric normal of the triangle
+	size_t meshIndex;
+	float pdfArea;                                       // probability density per unit area of the light surfaces
+};
+
+/// <summary>
+/// Picks emissive triangles proportionally to their power (area times emitted luminance) with an alias table
+/// (Walker 1977, Vose 1991) : a uniform number selects a bin, then either the bin's triangle or its alias, so
+/// sampling is O(1) whatever the number of lights. The table only stores indices into the scene meshes.
+/// </summary>
+class LightSampler
+{
+	public:
+		LightSampler() {}
+		// Materials of the meshes in the material table of the scene, see Scene::material
+		LightSampler(const std::vector<Mesh>& meshes, const std::vector<MaterialData>& materials, const std::vector<MaterialId>& materialIds);
+
+		inline bool empty() const { return m_triangles.empty(); }
+		inline size_t triangleCount() const { return m_triangles.size(); }
+		// Total emitted power up to a constant factor, 0 without emissive triangles
+		inline float power() const { return m_totalWeight; }
+
+		// Luminance emitted by the triangles of an emissive material, the power of a triangle is its area times this
+		static inline float emittedLuminance(const MaterialData& material)
+		{
+			const Vec3f& color = material.emission;
+			return 0.2126f * color[0] + 0.7152f * color[1] + 0.0722f * color[2];
+		}
+
+		// Samples a triangle with u, then a uniform point on it with (r1, r2), false without emissive triangles
+		bool sample(const std::vector<Mesh>& meshes, float u, float r1, float r2, EmissiveSample& sample) const;
+		// Area density of sample() on the triangles of an emissive material, the same for all of them
+		inline float pdfArea(const MaterialData& material) const { return m_totalWeight > 0.f ? emittedLuminance(material) / m_totalWeight : 0.f; }
+
+	private:
+		struct EmissiveTriangle
+		{
+			uint32_t mesh;
+			uint32_t triangle;
+		};
+
+		// Bin i keeps triangle i with probability m_threshold[i], m_alias[i] otherwise
+		std::vector<EmissiveTriangle> m_triangles;
+		std::vector<float> m_threshold;
+		std::vector<uint32_t> m_alias;
+		std::vector<float> m_pdfArea;                    // selection probability over area, per triangle
+		float m_totalWeight = 0.f;
+};
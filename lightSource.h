@@ -12,6 +12,8 @@ class LightSource
 	public:
 		inline virtual Vec3f colorResponse() const = 0;
 		inline virtual const Vec3f getPosition() const = 0;
+		// Point of the light for the uniform random numbers rd1, rd2 in [0,1)
+		inline virtual const Vec3f samplePosition(float rd1, float rd2) const = 0;
 };
 
 using lightPtr = std::shared_ptr<LightSource>;
@@ -24,6 +26,7 @@ class PointLight : public LightSource
 		PointLight() : LightSource() {}
 		inline Vec3f colorResponse() const { return m_color * m_intensity; };
 		inline const Vec3f getPosition() const { return m_position; }
+		inline const Vec3f samplePosition(float, float) const { return m_position; }
 };
 
 class AreaLight : public LightSource
@@ -68,10 +71,9 @@ class AreaLight : public LightSource
 			m_vertical = cross(normal, m_horizontal);
 			m_bottomLeftCorner = m_position - m_sideLength * 0.5f * (m_horizontal + m_vertical);
 		}
-		inline const Vec3f getPosition() const
+		inline const Vec3f getPosition() const { return m_position; }
+		inline const Vec3f samplePosition(float rd1, float rd2) const
 		{
-			float rd1 = (double)rand() / RAND_MAX;
-			float rd2 = (double)rand() / RAND_MAX;
 			return m_bottomLeftCorner + (rd1 * m_horizontal + rd2 * m_vertical)*m_sideLength;
 		}
 		inline Vec3f colorResponse() const { return m_color * m_intensity; };
@@ -21,11 +21,15 @@ int main(int argc, char* argv[])
     float aspectRatio = 1.f;
     size_t microBufferSize = 8;
     size_t rayPerPixel = 8;
+    size_t bounces = 1;
     size_t width = 700, height = 700;
     string filename="output.png";
-    Image image(width, height);
+    BVHBuildParams bvhParams;
+    bool bvhSpeedup = false;
+    Sampler::Type samplerType = Sampler::SOBOL;
+    RenderParams renderParams;
 
-    // CONSOLE USAGE : ./MyRayTracer width value -height value -output value -microbuffer value -rayperpixel value
+    // CONSOLE USAGE : ./MyRayTracer width value -height value -output value -microbuffer value -rayperpixel value -bounces value -bvh median|sah -bins value -leafsize value -bvhwidth 2|4|8 -bvhspeedup -watertight -sampler independent|sobol|halton|rank1 -tilesize value -tileorder scanline|morton|hilbert -progressive -passspp value -timebudget seconds -flush seconds -adaptive -threshold value -minspp value -maxspp value -heatmap file -wavefront -wavesize value -nopackets -sortrays -nolightbvh
     if (argc >1)
     {
         for (int i = 1; i < argc; i++)
@@ -55,9 +59,132 @@ int main(int argc, char* argv[])
                 rayPerPixel = std::stoi(argv[i + 1]);
                 std::cout << "ray per pixel : " << rayPerPixel << std::endl;
             }
+            else if (std::string(argv[i]) == "-bounces")
+            {
+                bounces = std::stoi(argv[i + 1]);
+                std::cout << "bounces : " << bounces << std::endl;
+            }
+            else if (std::string(argv[i]) == "-bvh")
+            {
+                bvhParams.splitMethod = std::string(argv[i + 1]) == "median" ? BVHBuildParams::MEDIAN : BVHBuildParams::SAH;
+                std::cout << "bvh split : " << argv[i + 1] << std::endl;
+            }
+            else if (std::string(argv[i]) == "-bins")
+            {
+                bvhParams.binCount = std::stoi(argv[i + 1]);
+                std::cout << "bvh bins : " << bvhParams.binCount << std::endl;
+            }
+            else if (std::string(argv[i]) == "-leafsize")
+            {
+                bvhParams.maxLeafSize = std::stoi(argv[i + 1]);
+                std::cout << "bvh max leaf size : " << bvhParams.maxLeafSize << std::endl;
+            }
+            else if (std::string(argv[i]) == "-bvhwidth")
+            {
+                bvhParams.width = std::stoi(argv[i + 1]);
+                std::cout << "bvh width : " << bvhParams.width << std::endl;
+            }
+            else if (std::string(argv[i]) == "-bvhspeedup")
+            {
+                bvhSpeedup = true;
+            }
+            else if (std::string(argv[i]) == "-watertight")
+            {
+                bvhParams.watertight = true;
+                std::cout << "watertight triangle intersection" << std::endl;
+            }
+            else if (std::string(argv[i]) == "-nolightbvh")
+            {
+                bvhParams.lightBVH = false;
+                std::cout << "lights sampled by power only" << std::endl;
+            }
+            else if (std::string(argv[i]) == "-sampler")
+            {
+                if (Sampler::parseType(argv[i + 1], samplerType)) std::cout << "sampler : " << argv[i + 1] << std::endl;
+                else std::cout << "unknown sampler : " << argv[i + 1] << std::endl;
+            }
+            else if (std::string(argv[i]) == "-tilesize")
+            {
+                renderParams.tileSize = std::stoi(argv[i + 1]);
+                std::cout << "tile size : " << renderParams.tileSize << std::endl;
+            }
+            else if (std::string(argv[i]) == "-tileorder")
+            {
+                if (TileScheduler::parseOrder(argv[i + 1], renderParams.tileOrder)) std::cout << "tile order : " << argv[i + 1] << std::endl;
+                else std::cout << "unknown tile order : " << argv[i + 1] << std::endl;
+            }
+            else if (std::string(argv[i]) == "-progressive")
+            {
+                renderParams.progressive = true;
+                std::cout << "progressive rendering" << std::endl;
+            }
+            else if (std::string(argv[i]) == "-passspp")
+            {
+                renderParams.samplesPerPass = std::stoi(argv[i + 1]);
+                std::cout << "samples per pass : " << renderParams.samplesPerPass << std::endl;
+            }
+            else if (std::string(argv[i]) == "-timebudget")
+            {
+                renderParams.progressive = true;
+                renderParams.timeBudget = std::stof(argv[i + 1]);
+                std::cout << "time budget : " << renderParams.timeBudget << "s" << std::endl;
+            }
+            else if (std::string(argv[i]) == "-flush")
+            {
+                renderParams.flushInterval = std::stof(argv[i + 1]);
+                std::cout << "flush interval : " << renderParams.flushInterval << "s" << std::endl;
+            }
+            else if (std::string(argv[i]) == "-adaptive")
+            {
+                renderParams.adaptive = true;
+                std::cout << "adaptive sampling" << std::endl;
+            }
+            else if (std::string(argv[i]) == "-threshold")
+            {
+                renderParams.errorThreshold = std::stof(argv[i + 1]);
+                std::cout << "error threshold : " << renderParams.errorThreshold << std::endl;
+            }
+            else if (std::string(argv[i]) == "-minspp")
+            {
+                renderParams.minSamples = std::stoi(argv[i + 1]);
+                std::cout << "min samples per pixel : " << renderParams.minSamples << std::endl;
+            }
+            else if (std::string(argv[i]) == "-maxspp")
+            {
+                renderParams.maxSamples = std::stoi(argv[i + 1]);
+                std::cout << "max samples per pixel : " << renderParams.maxSamples << std::endl;
+            }
+            else if (std::string(argv[i]) == "-heatmap")
+            {
+                renderParams.heatMapFile = argv[i + 1];
+                std::cout << "sample count heat map : " << renderParams.heatMapFile << std::endl;
+            }
+            else if (std::string(argv[i]) == "-wavefront")
+            {
+                renderParams.wavefront = true;
+                std::cout << "wavefront rendering" << std::endl;
+            }
+            else if (std::string(argv[i]) == "-wavesize")
+            {
+                renderParams.waveSize = std::stoi(argv[i + 1]);
+                std::cout << "wave size : " << renderParams.waveSize << " paths" << std::endl;
+            }
+            else if (std::string(argv[i]) == "-nopackets")
+            {
+                renderParams.packets = false;
+                std::cout << "no ray packets" << std::endl;
+            }
+            else if (std::string(argv[i]) == "-sortrays")
+            {
+                renderParams.sortRays = true;
+                std::cout << "sorted secondary rays" << std::endl;
+            }
         }
     }
 
+    // The image is created once its size is known
+    Image image(width, height);
+
     // MATERIALS
     MaterialPtr white = MaterialPtr(new MaterialGGX(Vec3f(1.f, 1.f, 1.f)));
     MaterialPtr red = MaterialPtr(new MaterialGGX(Vec3f(0.8f, 0.f, 0.f)));
@@ -91,20 +218,39 @@ int main(int argc, char* argv[])
     // CREATE SCENE
     Scene scene(cam, meshes, lights);
     std::cout << "Computing BVH for raytracing ... \n";
+    double serialBuildTime = 0.0;
+    if (bvhSpeedup)
+    {
+        // Reference single thread build to report the speedup of the parallel one
+        BVHBuildParams serialParams = bvhParams;
+        serialParams.parallel = false;
+        auto t1 = high_resolution_clock::now();
+        scene.computeBVH(serialParams);
+        auto t2 = high_resolution_clock::now();
+        serialBuildTime = duration<double>(t2 - t1).count();
+    }
     auto t1 = high_resolution_clock::now();
-    scene.computeBVH();
+    scene.computeBVH(bvhParams);
     auto t2 = high_resolution_clock::now();
     std::cout << "Done.  \n";
-    auto chrono = duration_cast<milliseconds>(t2 - t1);
-    std::cout << "BVH computation : " << chrono.count() * 0.001f << "s." << std::endl;
+    double buildTime = duration<double>(t2 - t1).count();
+    std::cout << "BVH computation : " << buildTime << "s (" << (bvhParams.parallel ? omp_get_max_threads() : 1) << " threads)." << std::endl;
+    if (bvhSpeedup)
+    {
+        std::cout << "BVH computation (1 thread) : " << serialBuildTime << "s, speedup : x" << serialBuildTime / buildTime << std::endl;
+    }
+    std::cout << "BVH SAH cost : " << scene.bvhCost() << std::endl;
 
     // RENDERING
     t1 = high_resolution_clock::now();
     std::cout << "Starting Rendering ...";
-    RayTracer::render(scene, image, rayPerPixel, 1);    
+    SamplerPtr sampler = Sampler::create(samplerType);
+    renderParams.rayPerPixel = rayPerPixel;
+    renderParams.bounces = bounces;
+    RayTracer::render(scene, image, renderParams, *sampler);    
     std::cout << "Done. \n";    
     t2 = high_resolution_clock::now();
-    chrono = duration_cast<milliseconds>(t2 - t1);
+    auto chrono = duration_cast<milliseconds>(t2 - t1);
     std::cout << "\nRendering : " << chrono.count() * 0.001f  << "s." << std::endl;    
     image.savePNG("test.png");
     return 0;
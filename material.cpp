@@ -0,0 +1,156 @@
+#include "material.h"
+#include "GeometryHelper.h"
+#include "Vec3simd.h"
+
+namespace
+{
+	// Visible normal of a GGX distribution for the local view direction wo, z being the surface normal (Heitz 2018,
+	// "Sampling the GGX Distribution of Visible Normals")
+	Vec3f sampleVisibleNormal(const Vec3f& wo, float alpha, float u1, float u2)
+	{
+		// Stretch the view direction to the hemisphere configuration
+		Vec3f vh = normalize(Vec3f(alpha * wo[0], alpha * wo[1], wo[2]));
+		float squaredLength = vh[0] * vh[0] + vh[1] * vh[1];
+		Vec3f t1 = squaredLength > 0.f ? Vec3f(-vh[1], vh[0], 0.f) / std::sqrt(squaredLength) : Vec3f(1.f, 0.f, 0.f);
+		Vec3f t2 = cross(vh, t1);
+		// Point on the projected hemisphere
+		float r = std::sqrt(u1);
+		float phi = 2.f * float(M_PI) * u2;
+		float p1 = r * std::cos(phi);
+		float p2 = r * std::sin(phi);
+		float s = 0.5f * (1.f + vh[2]);
+		p2 = (1.f - s) * std::sqrt(std::max(0.f, 1.f - p1 * p1)) + s * p2;
+		Vec3f nh = p1 * t1 + p2 * t2 + std::sqrt(std::max(0.f, 1.f - p1 * p1 - p2 * p2)) * vh;
+		// Back to the ellipsoid configuration
+		return normalize(Vec3f(alpha * nh[0], alpha * nh[1], std::max(1e-6f, nh[2])));
+	}
+}
+
+MaterialData Material::data() const
+{
+	MaterialData data;
+	data.type = type;
+	switch (type)
+	{
+	case GGX:
+	{
+		const MaterialGGX& ggx = static_cast<const MaterialGGX&>(*this);
+		data.albedo = ggx.albedo;
+		data.roughness = ggx.roughness;
+		data.metallic = ggx.metallic;
+		break;
+	}
+	case EMISSIVE:
+	{
+		const MaterialEmissive& emissive = static_cast<const MaterialEmissive&>(*this);
+		data.emission = Vec3f(emissive.emissive * emissive.color);
+		break;
+	}
+	}
+	data.precompute();
+	return data;
+}
+
+void MaterialData::precompute()
+{
+	alpha = std::max(roughness * roughness, kMinAlpha);
+	alpha2 = alpha * alpha;
+	diffuse = albedo / float(M_PI);
+	f0 = mix(Vec3f(0.04f), albedo, metallic);
+	f0Average = f0.average();
+	diffuseWeight = albedo.average();
+}
+
+Vec3f MaterialGGX::evalBSDFCosine(const Vec3f& position, const Vec3f& normal, const Vec3f& direction, const Vec3f& viewPoint) const
+{
+	return data().colorResponse(position, normal, direction, viewPoint);
+}
+
+bool MaterialData::sampleDirection(const Vec3f& position, const Vec3f& normal, const Vec3f& viewPoint, float uLobe, float u1, float u2, Vec3f& direction) const
+{
+	if (type == Material::GGX)
+	{
+		Vec3f wo = normalize(viewPoint - position);
+		if (dot(normal, wo) <= 0.f) return false;
+		if (uLobe < specularProbability(dot(normal, wo)))
+		{
+			Vec3f h = GeometryHelper::orientAlongNormal(sampleVisibleNormal(GeometryHelper::toNormalFrame(wo, normal), alpha, u1, u2), normal);
+			direction = normalize(2.f * dot(wo, h) * h - wo);
+			// Reflections below the surface carry nothing
+			return dot(normal, direction) > 0.f;
+		}
+	}
+	// Cosine weighted hemisphere
+	float pdf;
+	direction = normalize(GeometryHelper::sampleCosineHemisphereConcentric(u1, u2, normal, pdf));
+	return pdf > 0.f;
+}
+
+float MaterialData::pdf(const Vec3f& position, const Vec3f& normal, const Vec3f& direction, const Vec3f& viewPoint) const
+{
+	if (type == Material::GGX) return pdfGGX(normal, normalize(viewPoint - position), direction);
+	return std::max(dot(normal, direction), 0.f) * float(M_1_PI);
+}
+
+namespace
+{
+	inline Float8 schlickWeight8(const Float8& cosTheta)
+	{
+		Float8 m = Float8(1.f) - cosTheta;
+		Float8 m2 = m * m;
+		return m2 * m2 * m;
+	}
+
+	inline Float8 smithDenominator8(const Float8& cosTheta, const Float8& alpha2)
+	{
+		return cosTheta + sqrt(alpha2 + (Float8(1.f) - alpha2) * cosTheta * cosTheta);
+	}
+}
+
+// Same operations as MaterialData::evalGGX and pdfGGX on the 8 lanes, the material constants are gathered first
+void evalGGX8(GGXBatch& batch)
+{
+	alignas(32) float diffuse[3][kShadingBatchSize], f0[3][kShadingBatchSize];
+	alignas(32) float f0Average[kShadingBatchSize], diffuseWeight[kShadingBatchSize], alpha2[kShadingBatchSize];
+	for (int lane = 0; lane < kShadingBatchSize; lane++)
+	{
+		const MaterialData* material = batch.m_material[lane];
+		for (int c = 0; c < 3; c++)
+		{
+			diffuse[c][lane] = material ? material->diffuse[c] : 0.f;
+			f0[c][lane] = material ? material->f0[c] : 0.f;
+		}
+		f0Average[lane] = material ? material->f0Average : 0.f;
+		diffuseWeight[lane] = material ? material->diffuseWeight : 0.f;
+		alpha2[lane] = material ? material->alpha2 : 1.f;
+	}
+
+	Float8 zero(0.f), one(1.f);
+	Vec3x8 n = Vec3x8::load(batch.m_normal), wo = Vec3x8::load(batch.m_wo), wi = Vec3x8::load(batch.m_wi);
+	Float8 a2 = Float8::load(alpha2);
+	Float8 cosI = dot(n, wi);
+	Float8 cosO = dot(n, wo);
+	Vec3x8 h = normalize(wi + wo);
+	Float8 cosH = dot(n, h);
+	Float8 t = one + cosH * cosH * (a2 - one);
+	Float8 ndf = a2 / (Float8(float(M_PI)) * t * t);
+	Float8 denominatorO = smithDenominator8(cosO, a2);
+	Bool8 frontI = cosI > zero;
+
+	// colorResponse, black below the surface
+	Float8 specular = ndf / (smithDenominator8(cosI, a2) * denominatorO);
+	Float8 weight = schlickWeight8(vmax(dot(wi, h), zero));
+	Vec3x8 f = Vec3x8::load(f0);
+	Vec3x8 fresnel = f + (Vec3x8(Vec3f(1.f)) - f) * weight;
+	Vec3x8 color = (Vec3x8::load(diffuse) + fresnel * specular) * cosI;
+	select(frontI, color, Vec3x8(Vec3f(0.f))).store(batch.m_color);
+
+	// pdf
+	Float8 average = Float8::load(f0Average);
+	Float8 specularWeight = average + (one - average) * schlickWeight8(vmax(cosO, zero));
+	Float8 total = specularWeight + Float8::load(diffuseWeight);
+	Float8 probability = select(total > zero, specularWeight / total, Float8(0.5f));
+	Float8 specularPdf = select(frontI & (cosO > zero), ndf / (Float8(2.f) * denominatorO), zero);
+	Float8 diffusePdf = vmax(cosI, zero) * Float8(float(M_1_PI));
+	(probability * specularPdf + (one - probability) * diffusePdf).store(batch.m_pdf);
+}
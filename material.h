@@ -2,8 +2,17 @@
 #include"Vec3.h"
 #include"lightSource.h"
 #include"camera.h"
+#include<cstdint>
 
+struct MaterialData;
 
+// Index of a material in the material table of the scene
+typedef uint32_t MaterialId;
+
+/// <summary>
+/// Description of a material when building a scene. Rendering doesn't go through these objects : the scene copies
+/// them into a flat table of MaterialData, see Scene::material.
+/// </summary>
 class Material
 {
 public:
@@ -13,7 +22,8 @@ public:
 		EMISSIVE,
 	};
 
-	virtual Vec3f colorResponse(const Vec3f& position, const Vec3f& normal, const Vec3f& direction, const Vec3f& viewPoint) = 0;
+	// Plain copy of the parameters of the material for the material table
+	MaterialData data() const;
 
 	MaterialType type;
 };
@@ -37,68 +47,138 @@ public:
 	MaterialGGX(Vec3f _albedo, float _diffuse, float _roughness, float _specular) : albedo(_albedo), roughness(_roughness), metallic(_specular) { type = MaterialType::GGX; };
 	MaterialGGX(Vec3f _albedo) : albedo(_albedo) { roughness = 1.0f; metallic = 0.0f; type = MaterialType::GGX; };
 
-	Vec3f Material::colorResponse(const Vec3f& position, const Vec3f& normal, const Vec3f& direction, const Vec3f& viewPoint) override
-	{
-		return evalBSDFCosine(position, normal, direction, viewPoint);
-	}
-
-	Vec3f evalBSDFCosine(const Vec3f& position, const Vec3f& normal, const Vec3f& direction, const Vec3f& viewPoint) const
-	{
-		Vec3f diffuseResponse(albedo / (float)M_PI);
-		Vec3f specularResponse = reflectance(direction, normalize(viewPoint - position), normal);
-		return (diffuseResponse + specularResponse) * std::max(dot(normal, direction), 0.f);
-	};
+	Vec3f evalBSDFCosine(const Vec3f& position, const Vec3f& normal, const Vec3f& direction, const Vec3f& viewPoint) const;
 
 	Vec3f diffuseBSDFCosine(const Vec3f& normal, const Vec3f& direction) const
 	{
 		return (albedo / M_PI) * std::max(dot(normal, direction), 0.f);
 	}
+};
 
-private:
+class MaterialEmissive : public Material
+{
+public :
+	float emissive = 1.0f;
+	Vec3f color{ 1.0f, 1.0f, 1.0f };
 
-	inline Vec3f reflectance(const Vec3f& wi, const Vec3f& wo, const Vec3f& n) const
+	MaterialEmissive(const Vec3f& _color, float _emissive) : emissive(_emissive), color(_color) { type = Material::EMISSIVE; };
+};
+
+/// <summary>
+/// Material as stored in the material table of the scene : the type tag and the parameters of every type, shading
+/// is a switch on the tag. Render loops read these by reference, there is no virtual call nor shared pointer
+/// copy per hit.
+/// </summary>
+struct MaterialData
+{
+	Material::MaterialType type = Material::GGX;
+	// GGX
+	Vec3f albedo;
+	float roughness = 1.f;
+	float metallic = 0.f;
+	// Emissive, color times intensity
+	Vec3f emission;
+
+	// Constants of the GGX evaluation derived from the parameters by precompute()
+	float alpha = 1.f;
+	float alpha2 = 1.f;
+	Vec3f diffuse;                                       // albedo / pi
+	Vec3f f0;                                            // Fresnel reflectance at normal incidence
+	float f0Average = 0.f;
+	float diffuseWeight = 0.f;                           // albedo average, against f0 when picking a lobe
+
+	// To call after changing the parameters
+	void precompute();
+
+	inline Vec3f colorResponse(const Vec3f& position, const Vec3f& normal, const Vec3f& direction, const Vec3f& viewPoint) const
 	{
-		float alpha = roughness * roughness;
-		Vec3f wh = normalize(wi + wo);
-		Vec3f F0(0.04f);
-		F0 = mix(F0, albedo, metallic);
-		float term1 = G_GGX(wi, wo, alpha, n);
-		Vec3f term2 = F(std::max(dot(wi, wh), 0.f), F0);
-		float term3 = D(alpha, wh, n);
-		return term1 * term2 * term3 / (4 * dot(n, wi) * dot(n, wo));
+		switch (type)
+		{
+		case Material::EMISSIVE:
+			return emission;
+		case Material::GGX:
+		default:
+			return evalGGX(normal, normalize(viewPoint - position), direction);
+		}
 	}
 
-	inline float G(const Vec3f& w, const Vec3f& n, float alpha) const
+	// Importance sampling of colorResponse : a direction the light reflected towards viewPoint is likely to come from,
+	// uLobe picks a lobe and (u1, u2) a direction in it. False if no direction could be generated.
+	// GGX materials pick between cosine sampling of the diffuse lobe and visible normal sampling of the specular
+	// lobe (Heitz 2018) according to their Fresnel weighted albedo, the others sample the cosine weighted hemisphere
+	bool sampleDirection(const Vec3f& position, const Vec3f& normal, const Vec3f& viewPoint, float uLobe, float u1, float u2, Vec3f& direction) const;
+	// Solid angle density of sampleDirection
+	float pdf(const Vec3f& position, const Vec3f& normal, const Vec3f& direction, const Vec3f& viewPoint) const;
+
+	// GGX colorResponse and pdf for the normalized view direction wo and light direction wi
+	inline Vec3f evalGGX(const Vec3f& n, const Vec3f& wo, const Vec3f& wi) const
 	{
-		return 2.0 * (dot(n, w)) / (dot(n, w) + sqrt(pow(alpha, 2) + (1 - pow(alpha, 2)) * pow(dot(n, w), 2)));
+		float cosI = dot(n, wi);
+		if (cosI <= 0.f) return Vec3f(0.f);
+		Vec3f h = normalize(wi + wo);
+		// The Smith masking terms G1(wi) G1(wo) cancel out with the 4 cos(wi) cos(wo) of the microfacet BRDF
+		float specular = ndf(dot(n, h)) / (smithDenominator(cosI) * smithDenominator(dot(n, wo)));
+		Vec3f fresnel = f0 + (Vec3f(1.f) - f0) * schlickWeight(std::max(dot(wi, h), 0.f));
+		return (diffuse + fresnel * specular) * cosI;
 	}
 
-	inline float G_GGX(const Vec3f& wi, const Vec3f& wo, float alpha, const Vec3f& n) const
+	inline float pdfGGX(const Vec3f& n, const Vec3f& wo, const Vec3f& wi) const
 	{
-		return G(wi, n, alpha) * G(wo, n, alpha);
+		float cosI = dot(n, wi);
+		float cosO = dot(n, wo);
+		float specular = specularProbability(cosO);
+		// Density of the reflected visible normals : G1(wo) D(h) / (4 cos(wo))
+		float specularPdf = cosO > 0.f && cosI > 0.f ? ndf(dot(n, normalize(wi + wo))) / (2.f * smithDenominator(cosO)) : 0.f;
+		return specular * specularPdf + (1.f - specular) * (std::max(cosI, 0.f) * float(M_1_PI));
 	}
 
-	inline Vec3f F(float cosTheta, const Vec3f& f0) const
+private:
+	// Keeps the distribution finite for perfectly smooth surfaces
+	static constexpr float kMinAlpha = 1e-3f;
+
+	// Probability of sampling the specular lobe, from the Fresnel reflectance of the view direction
+	inline float specularProbability(float cosO) const
 	{
-		return f0 + (Vec3f(1.f, 1.f, 1.f) - f0) * pow(1.0 - cosTheta, 5.0);
+		float specular = f0Average + (1.f - f0Average) * schlickWeight(std::max(cosO, 0.f));
+		float total = specular + diffuseWeight;
+		return total > 0.f ? specular / total : 0.5f;
 	}
 
-	inline float D(float alpha, const Vec3f& m, const Vec3f& n) const
+	// Trowbridge-Reitz distribution of the normals
+	inline float ndf(float cosH) const
 	{
-		return (pow(alpha, 2)) / (3.1415926 * pow((1 + pow(dot(n, m), 2) * (pow(alpha, 2) - 1)), 2));
+		float t = 1.f + cosH * cosH * (alpha2 - 1.f);
+		return alpha2 / (float(M_PI) * t * t);
 	}
-};
 
-class MaterialEmissive : public Material
-{
-public :
-	float emissive = 1.0f;
-	Vec3f color{ 1.0f, 1.0f, 1.0f };
-
-	MaterialEmissive(const Vec3f& _color, float _emissive) : emissive(_emissive), color(_color) { type = Material::EMISSIVE; };
+	// G1(w) = 2 cos(w) / smithDenominator(cos(w))
+	inline float smithDenominator(float cosTheta) const
+	{
+		return cosTheta + std::sqrt(alpha2 + (1.f - alpha2) * cosTheta * cosTheta);
+	}
 
-	Vec3f Material::colorResponse(const Vec3f& position, const Vec3f& normal, const Vec3f& direction, const Vec3f& viewPoint) override
+	// Schlick's (1 - cos)^5
+	static inline float schlickWeight(float cosTheta)
 	{
-		return Vec3f(emissive * color);
+		float m = 1.f - cosTheta;
+		float m2 = m * m;
+		return m2 * m2 * m;
 	}
 };
+
+// Shading points of GGX materials as structure of arrays (m_normal[axis][lane]), see evalGGX8.
+// Directions are normalized, unused lanes have a null material and get black with a zero density
+const int kShadingBatchSize = 8;
+struct alignas(32) GGXBatch
+{
+	const MaterialData* m_material[kShadingBatchSize];
+	float m_normal[3][kShadingBatchSize];
+	float m_wo[3][kShadingBatchSize];
+	float m_wi[3][kShadingBatchSize];
+	// Outputs : colorResponse and pdf
+	float m_color[3][kShadingBatchSize];
+	float m_pdf[kShadingBatchSize];
+};
+
+// MaterialData::evalGGX and pdfGGX for all the lanes of the batch at once, with AVX when available
+void evalGGX8(GGXBatch& batch);
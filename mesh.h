@@ -36,14 +36,14 @@ class Mesh
 		inline std::vector<Vec3i>& indices() { return m_indices; }		
 		inline std::vector<Vec3f>& normals() { return m_normals; }
 		inline AABB& boundingBox() { return m_boundingBox; }
-		inline MaterialPtr material() { return m_mat; }
+		inline const MaterialPtr& material() { return m_mat; }
 		//const accessors
 		inline const std::vector<Vec3f>& vertices() const { return m_vertices; }
 		inline const std::vector<Vec3i>& indices() const { return m_indices; }
 		inline const Vec3<Vec3f> triangle(Vec3i triangleIndices) const { return Vec3<Vec3f>(m_vertices[triangleIndices[0]], m_vertices[triangleIndices[1]], m_vertices[triangleIndices[2]]); }
 		inline const std::vector<Vec3f>& normals() const { return m_normals; }
 		inline const AABB& boundingBox() const { return m_boundingBox; }
-		inline const MaterialPtr material() const { return m_mat; }	
+		inline const MaterialPtr& material() const { return m_mat; }	
 		//Cornell Box initializer		
 };
 
@@ -20,6 +20,7 @@ Image PointBasedRenderer::render(const Scene& scene, const PointCloud& pointClou
 		for (int i = 0; i < width; i++)
 		{
 			//create rays for intersection test					
+			RNG rng(uint64_t(j) * width + i);
 			Vec3f totalColorResponse;	
 			bool intersection=false;
 			for (int k = 0; k < rayPerPixel; k++)
@@ -30,7 +31,7 @@ Image PointBasedRenderer::render(const Scene& scene, const PointCloud& pointClou
 				else
 				{
 					// jittering
-					Vec3f jitteredDirection = normalize(renderCam.getPosition() - renderCam.getImageCoordinate(float(i) / width + ((std::rand() % 100) / (float)100) * (1 / (float)width), 1.f - (((float)j / height) + ((std::rand() % 100) / (float)100) * (1 / (float)height))));
+					Vec3f jitteredDirection = normalize(renderCam.getPosition() - renderCam.getImageCoordinate(float(i) / width + rng.nextFloat() * (1 / (float)width), 1.f - (((float)j / height) + rng.nextFloat() * (1 / (float)height))));
 					scatteredRay = Ray(renderCam.getPosition(), jitteredDirection);
 				}
 				Vec3f intersectionPos, intersectionNormal; size_t meshIndex;
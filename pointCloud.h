@@ -6,6 +6,8 @@
 #include "scene.h"
 #include "surfel.h"
 #include "BSHnode.h"
+#include "rng.h"
+#include "sampler.h"
 #include <ctime>
 
 class PointCloud {
@@ -21,6 +23,7 @@ public:
 	{
 		float sampleRad = 1 / (sqrt(m_samplingRate));		
 		const std::vector<Mesh>& meshes = scene.meshes();
+		IndependentSampler sampler;
 		for (int i = 0; i < meshes.size(); i++)
 		{			
 			for (int j = 0; j < meshes[i].indices().size(); j++)
@@ -38,7 +41,8 @@ public:
 						//compute surfel attributes for best candidate and add to the list	
 						Vec3f samplePos = sampleP[k];
 						Vec3f sampleNorm = sampleN[k];
-						Vec3f sampleColor = RayTracer::evalDirect(samplePos, sampleNorm, meshes[i].material(), scene);					
+						sampler.startPixelSample(i, j, k);
+						Vec3f sampleColor = RayTracer::evalDirect(samplePos, sampleNorm, scene.camera().getPosition(), scene.material(i), scene, false, sampler);					
 						Surfel sampleSurfel = Surfel(samplePos, sampleNorm, sampleColor, sampleRad);
 						m_surfels.push_back(sampleSurfel);
 					}					
@@ -72,13 +76,13 @@ public:
 	}
 
 	//Mitchell's best candidate algorithm
-	void BestCandidateSampling(const Mesh& mesh, const Vec3i& triangleIndices, int Nsamples, std::vector<Vec3f>& samplePositions, std::vector<Vec3f>& sampleNorm, float sampleRad)
+	void BestCandidateSampling(const Mesh& mesh, const Vec3i& triangleIndices, int Nsamples, std::vector<Vec3f>& samplePositions, std::vector<Vec3f>& sampleNorm, float sampleRad, RNG& rng)
 	{				
 		float minSquaredRad = sampleRad * sampleRad;
 		//First random point near center
-		float r1 = -0.1f + static_cast <float> (rand()) / (static_cast <float> (RAND_MAX/0.2f));
-		float r2 = -0.1f + static_cast <float> (rand()) / (static_cast <float> (RAND_MAX/0.2f));
-		float r3 = -0.1f + static_cast <float> (rand()) / (static_cast <float> (RAND_MAX/0.2f));
+		float r1 = rng.nextFloat(-0.1f, 0.1f);
+		float r2 = rng.nextFloat(-0.1f, 0.1f);
+		float r3 = rng.nextFloat(-0.1f, 0.1f);
 		Vec3f sampleBarCoord = Vec3f(r1, r2, r3);
 		Vec3f samplePos = mesh.interpPos(sampleBarCoord, triangleIndices);		
 		samplePositions.push_back(samplePos);
@@ -91,9 +95,9 @@ public:
 			//find the best point (maximizing distance with other close samples) among 10 candidates
 			for (int l = 0; l < 20; l++)
 			{							
-				float rd1 = -0.5f + static_cast <float> (rand()) / (static_cast <float> (RAND_MAX));
-				float rd2 = -0.5f + static_cast <float> (rand()) / (static_cast <float> (RAND_MAX));
-				float rd3 = -0.5f + static_cast <float> (rand()) / (static_cast <float> (RAND_MAX));
+				float rd1 = rng.nextFloat(-0.5f, 0.5f);
+				float rd2 = rng.nextFloat(-0.5f, 0.5f);
+				float rd3 = rng.nextFloat(-0.5f, 0.5f);
 				Vec3f barCoord = Vec3f(0.5f) + Vec3f(rd1, rd2, rd3);
 				Vec3f pos = mesh.interpPos(barCoord, triangleIndices);
 				float squaredDist = 0; size_t nNeighbors = 0;
@@ -119,13 +123,13 @@ public:
 	}
 
 	//Pure random sampling
-	void UniformSampling(const Mesh& mesh, const Vec3i& triangleIndices, int Nsamples, std::vector<Vec3f>& samplePositions, std::vector<Vec3f>& sampleNorm)
+	void UniformSampling(const Mesh& mesh, const Vec3i& triangleIndices, int Nsamples, std::vector<Vec3f>& samplePositions, std::vector<Vec3f>& sampleNorm, RNG& rng)
 	{		
 		for (int k = 0; k < Nsamples - 1; k++)
 		{
-			float r1 = static_cast <float> (rand()) / (static_cast <float> (RAND_MAX));
-			float r2 = static_cast <float> (rand()) / (static_cast <float> (RAND_MAX));
-			float r3 = static_cast <float> (rand()) / (static_cast <float> (RAND_MAX));
+			float r1 = rng.nextFloat();
+			float r2 = rng.nextFloat();
+			float r3 = rng.nextFloat();
 			Vec3f sampleBarCoord = Vec3f(r1, r2, r3);
 			Vec3f samplePos = mesh.interpPos(sampleBarCoord, triangleIndices);
 			samplePositions.push_back(samplePos);		
@@ -135,15 +139,15 @@ public:
 
 
 	//Simple blue-noise sampling
-	void BlueNoiseSampling(const Mesh& mesh, const Vec3i& triangleIndices, int Nsamples, std::vector<Vec3f>& samplePositions, std::vector<Vec3f>& sampleNorm, float sampleRad)
+	void BlueNoiseSampling(const Mesh& mesh, const Vec3i& triangleIndices, int Nsamples, std::vector<Vec3f>& samplePositions, std::vector<Vec3f>& sampleNorm, float sampleRad, RNG& rng)
 	{
 		std::vector<Vec3f> samplePositionsTmp;
 		std::vector<Vec3f> sampleNormTmp;
 		for (int k = 0; k < 10*Nsamples - 1; k++)
 		{
-			float r1 = static_cast <float> (rand()) / (static_cast <float> (RAND_MAX));
-			float r2 = static_cast <float> (rand()) / (static_cast <float> (RAND_MAX));
-			float r3 = static_cast <float> (rand()) / (static_cast <float> (RAND_MAX));
+			float r1 = rng.nextFloat();
+			float r2 = rng.nextFloat();
+			float r3 = rng.nextFloat();
 			Vec3f sampleBarCoord = Vec3f(r1, r2, r3);
 			Vec3f samplePos = mesh.interpPos(sampleBarCoord, triangleIndices);
 			samplePositionsTmp.push_back(samplePos);
@@ -153,7 +157,7 @@ public:
 		float maxRadiusSquare = sampleRad*sampleRad;
 		while (iter > 0 && samplePositionsTmp.size() > Nsamples)
 		{			
-			int rd = rand()%samplePositionsTmp.size();
+			int rd = int(rng.nextUInt(uint32_t(samplePositionsTmp.size())));
 			Vec3f rdSample = samplePositionsTmp[rd];
 			//samplePositions.push_back(samplePositionsTmp[rd]);
 			//sampleNorm.push_back(sampleNormTmp[rd]);
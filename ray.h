@@ -1,32 +1,49 @@
 #pragma once
+#include<limits>
+#include<cstdint>
+#include<algorithm>
 #include"surfel.h"
+#include"Vec3simd.h"
 struct Ray
 {
-	Vec3f m_origin;
-	Vec3f m_direction;
-	Ray(const Vec3f& origin, const Vec3f&  direction) : m_origin(origin), m_direction(direction) {};	
-	Ray() : m_origin(Vec3f(0, 0, 0)), m_direction(Vec3f(0, 0, 1)) {};
+	Vec3fa m_origin;
+	Vec3fa m_direction;
+	// Precomputed for slab tests : 1/direction and whether each component is negative
+	Vec3fa m_invDirection;
+	uint8_t m_sign[3];
+	// Valid parametric interval of the ray
+	float m_tMin;
+	float m_tMax;
+	Ray(const Vec3fa& origin, const Vec3fa& direction, float tMin = 0.f, float tMax = std::numeric_limits<float>::max()) : m_origin(origin), m_direction(direction), m_tMin(tMin), m_tMax(tMax) { init(); };
+	Ray() : m_origin(0.f, 0.f, 0.f), m_direction(0.f, 0.f, 1.f), m_tMin(0.f), m_tMax(std::numeric_limits<float>::max()) { init(); };
+
+	inline void init()
+	{
+		m_invDirection = reciprocal(m_direction);
+		for (int i = 0; i < 3; i++) m_sign[i] = m_invDirection[i] < 0.f ? 1 : 0;
+	}
 
 	const bool testTriangleIntersection(const Vec3<Vec3f>& trianglePos, Vec3f& barCoord, float& parT, float threshold = 0.000001f) const
 	{
-		Vec3f e0 = trianglePos[1] - trianglePos[0];
-		Vec3f e1 = trianglePos[2] - trianglePos[0];		
-		Vec3f q = cross(m_direction, e1);
+		Vec3fa v0 = trianglePos[0];
+		Vec3fa e0 = Vec3fa(trianglePos[1]) - v0;
+		Vec3fa e1 = Vec3fa(trianglePos[2]) - v0;
+		Vec3fa q = cross(m_direction, e1);
 		float a = dot(e0, q);
 		//check if triangle is parallel
 		if (abs(a) < threshold)
 		{			
 			return false;
 		}
-		Vec3f s = (m_origin - trianglePos[0])/a;
+		Vec3fa s = (m_origin - v0)/a;
 		float b0 = dot(s, q);
 		if (b0 < 0.f || b0 > 1.0f) return false;
-		Vec3f r = cross(s, e0);
+		Vec3fa r = cross(s, e0);
 		float b1 = dot(r, m_direction);
 		if (b1 < 0.0f || b0 + b1 > 1.0f) return false;
 		float b2 = 1 - b0 - b1;
 		float t = dot(e1, r);
-		if (t > threshold)
+		if (t > threshold && t >= m_tMin && t <= m_tMax)
 		{
 			barCoord = Vec3f(b0, b1, b2);
 			parT = t;
@@ -35,14 +52,53 @@ struct Ray
 		return false;
 	}
 
-	bool testPlaneIntersection(const Vec3f& planePos, const Vec3f& planeNormal, Vec3f& intersectionPos, float& parT, float threshold = 0.0001f)
+	// Watertight test (Woop et al. 2013) : the triangle is moved to ray space, sheared so that the ray goes along +z,
+	// and tested with 2D edge functions. Edges shared by two triangles can't be missed by both.
+	bool testTriangleIntersectionWatertight(const Vec3<Vec3f>& trianglePos, Vec3f& barCoord, float& parT) const
+	{
+		// Permute the axes so that z is the largest direction component, and keep the winding
+		int kz = 0;
+		if (abs(m_direction[1]) > abs(m_direction[kz])) kz = 1;
+		if (abs(m_direction[2]) > abs(m_direction[kz])) kz = 2;
+		int kx = (kz + 1) % 3;
+		int ky = (kx + 1) % 3;
+		if (m_direction[kz] < 0.f) std::swap(kx, ky);
+		float sx = m_direction[kx] * m_invDirection[kz];
+		float sy = m_direction[ky] * m_invDirection[kz];
+		float sz = m_invDirection[kz];
+		Vec3f a = trianglePos[0] - m_origin;
+		Vec3f b = trianglePos[1] - m_origin;
+		Vec3f c = trianglePos[2] - m_origin;
+		float ax = a[kx] - sx * a[kz], ay = a[ky] - sy * a[kz];
+		float bx = b[kx] - sx * b[kz], by = b[ky] - sy * b[kz];
+		float cx = c[kx] - sx * c[kz], cy = c[ky] - sy * c[kz];
+		// Scaled barycentric coordinates of the three vertices. The products of floats are exact in double, so the
+		// edge shared by two triangles gets exactly opposite values even if the compiler fuses multiply and add
+		float u = float(double(cx) * double(by) - double(cy) * double(bx));
+		float v = float(double(ax) * double(cy) - double(ay) * double(cx));
+		float w = float(double(bx) * double(ay) - double(by) * double(ax));
+		if ((u < 0.f || v < 0.f || w < 0.f) && (u > 0.f || v > 0.f || w > 0.f)) return false;
+		float det = u + v + w;
+		if (det == 0.f) return false;
+		// Scaled distance, compared to the interval without dividing
+		float t = u * sz * a[kz] + v * sz * b[kz] + w * sz * c[kz];
+		float absDet = abs(det);
+		float signedT = det < 0.f ? -t : t;
+		if (signedT <= 0.f || signedT < m_tMin * absDet || signedT > m_tMax * absDet) return false;
+		float invDet = 1.f / det;
+		barCoord = Vec3f(v * invDet, w * invDet, u * invDet);
+		parT = t * invDet;
+		return true;
+	}
+
+	bool testPlaneIntersection(const Vec3f& planePos, const Vec3f& planeNormal, Vec3f& intersectionPos, float& parT, float threshold = 0.0001f) const
 	{
 		normalize(planeNormal);
 		float denom = dot(m_direction, planeNormal);
 		if(abs(denom) > 1e-6)
 		{
 			parT = dot(planePos - m_origin, planeNormal)/denom;
-			if (parT >= 0)
+			if (parT >= m_tMin && parT <= m_tMax)
 			{
 				intersectionPos = m_origin + parT * m_direction;
 				return true;
@@ -51,7 +107,7 @@ struct Ray
 		return false;
 	}
 
-	bool testDiscIntersection(const Vec3f& discPos,const Vec3f& discNormal, float radius, Vec3f& intersectionPos, float& parT, float threshold = 0.0001f)
+	bool testDiscIntersection(const Vec3f& discPos,const Vec3f& discNormal, float radius, Vec3f& intersectionPos, float& parT, float threshold = 0.0001f) const
 	{
 		if (testPlaneIntersection(discPos, discNormal, intersectionPos, parT, threshold))
 		{			
@@ -67,8 +123,10 @@ struct Ray
 		else return false;
 	}
 
-	bool testSurfelIntersection(Surfel surfel, Vec3f& intersectionPos, float& parT, float threshold = 0.0001f)
+	bool testSurfelIntersection(const Surfel& surfel, Vec3f& intersectionPos, float& parT, float threshold = 0.0001f) const
 	{
 		return testDiscIntersection(surfel.position, surfel.normal, surfel.radius, intersectionPos, parT, threshold);
 	}
-};
\ No newline at end of file
+};
+// The padded vectors and the byte signs keep a ray in one cache line
+static_assert(sizeof(Ray) == 64, "Ray should fit in 64 bytes");
\ No newline at end of file
@@ -1,80 +1,306 @@
 #include "rayTracer.h"
+#include "wavefront.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 //called to render image from scene
-void RayTracer::render(const Scene& scene, Image& renderImage, size_t rayPerPixel = 8, size_t bounces = 0)
+void RayTracer::render(const Scene& scene, Image& renderImage, const RenderParams& params, const Sampler& sampler)
 {
-	const std::vector<Mesh>& sceneMeshes = scene.meshes();	
-	const Camera& renderCam = scene.camera();
-	const Vec3f& camPos = renderCam.getPosition();
-
 	// Fill background of the image with arbitrary color
 	renderImage.fillBackground(Vec3f(0.5, 0.5, 0.5), Vec3f(0.1f, 0.1f, 0.1f));
-	int width = renderImage.getWidth(); 
-	int height = renderImage.getHeight();
+	renderImage.clearAccumulation();
+	if (params.adaptive)
+	{
+		renderAdaptive(scene, renderImage, params, sampler);
+	}
+	else if (!params.progressive)
+	{
+		renderPass(scene, renderImage, params, sampler, std::max<size_t>(1, params.rayPerPixel));
+		renderImage.resolve();
+	}
+	else
+	{
+		renderProgressive(scene, renderImage, params, sampler);
+	}
+	if (!params.heatMapFile.empty()) renderImage.saveSampleCountPNG(params.heatMapFile.c_str());
+}
 
-	#pragma omp parallel for schedule(dynamic, 1)  
-	for (int y = 0; y < height; y++)
+// Progressive : passes of samplesPerPass samples until the target sample count or the time budget is reached
+void RayTracer::renderProgressive(const Scene& scene, Image& renderImage, const RenderParams& params, const Sampler& sampler)
+{
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point start = Clock::now();
+	Clock::time_point lastFlush = start;
+	size_t targetSamples = params.rayPerPixel > 0 ? params.rayPerPixel : std::numeric_limits<size_t>::max();
+	if (params.timeBudget <= 0.f) targetSamples = std::max<size_t>(1, params.rayPerPixel);
+	size_t samples = 0;
+	float lastPassTime = 0.f;
+	while (samples < targetSamples)
 	{
-		// Display progress in percentage
-		fprintf(stderr, "\rRendering (%i samples): %.2f%% ",rayPerPixel, (double)y / height * 100);
+		// Stop before a pass that would overrun the budget
+		float elapsed = std::chrono::duration<float>(Clock::now() - start).count();
+		if (samples > 0 && params.timeBudget > 0.f && elapsed + lastPassTime > params.timeBudget) break;
+		size_t passSamples = std::min(std::max<size_t>(1, params.samplesPerPass), targetSamples - samples);
+		Clock::time_point passStart = Clock::now();
+		renderPass(scene, renderImage, params, sampler, passSamples);
+		lastPassTime = std::chrono::duration<float>(Clock::now() - passStart).count();
+		samples += passSamples;
+		renderImage.resolve();
+		if (params.flushInterval > 0.f && std::chrono::duration<float>(Clock::now() - lastFlush).count() >= params.flushInterval)
+		{
+			renderImage.savePNG(params.flushFile.c_str());
+			lastFlush = Clock::now();
+		}
+	}
+	fprintf(stderr, "\rProgressive rendering : %i samples per pixel in %.2fs ", int(samples), std::chrono::duration<float>(Clock::now() - start).count());
+}
 
-		for (int x = 0; x < width; x++)
+// Adaptive : every pixel gets minSamples samples, then the rest of the rayPerPixel * pixels budget is spent
+// in passes over the pixels whose error is still above the threshold
+void RayTracer::renderAdaptive(const Scene& scene, Image& renderImage, const RenderParams& params, const Sampler& sampler)
+{
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point start = Clock::now();
+	Clock::time_point lastFlush = start;
+	int width = int(renderImage.getWidth());
+	int height = int(renderImage.getHeight());
+	size_t pixelCount = size_t(width) * height;
+	size_t rayPerPixel = std::max<size_t>(1, params.rayPerPixel);
+	size_t budget = rayPerPixel * pixelCount;
+	// At least 2 samples for a variance estimate. By default a quarter of the budget is spent uniformly, leaving
+	// the rest to the pixels with the largest errors
+	size_t minSamples = std::max<size_t>(2, params.minSamples > 0 ? std::min(params.minSamples, rayPerPixel) : rayPerPixel / 4);
+	size_t maxSamples = params.maxSamples > 0 ? std::max(params.maxSamples, minSamples) : 8 * rayPerPixel;
+	// Errors are re-evaluated every passSamples samples
+	size_t passSamples = std::max(params.samplesPerPass, minSamples);
+
+	renderPass(scene, renderImage, params, sampler, minSamples);
+	size_t used = minSamples * pixelCount;
+	renderImage.resolve();
+
+	std::vector<float> errors(pixelCount);
+	std::vector<uint32_t> pixelSamples(pixelCount, 0);
+	while (used < budget)
+	{
+		if (params.timeBudget > 0.f && std::chrono::duration<float>(Clock::now() - start).count() > params.timeBudget) break;
+
+		#pragma omp parallel for
+		for (int i = 0; i < int(pixelCount); i++)
+		{
+			errors[i] = renderImage.pixelError(i % width, i / width);
+		}
+		// A pixel stops once its whole 3x3 neighbourhood is below the threshold : a pixel whose few
+		// samples happened to agree (e.g. all of them missed a small light) doesn't stop on its own
+		int activeCount = 0;
+		#pragma omp parallel for reduction(+:activeCount)
+		for (int i = 0; i < int(pixelCount); i++)
 		{
-			Vec3f totalColorResponse(0,0,0);			
-			for (int k = 0; k < rayPerPixel; k++)
+			int x = i % width, y = i / width;
+			float error = 0.f;
+			for (int v = std::max(0, y - 1); v <= std::min(height - 1, y + 1); v++)
 			{
-				// Pixel sampling
-				float rd_width = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-				float rd_height = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-				Ray scatteredRay = renderCam.rayAt((float(x) + rd_width)/ width, 1.f - (float(y) + rd_height)/height);
-
-				// Ray tracing 
-				Vec3f hitPosition, hitNormal;
-				size_t meshIndex;
-				if (rayTraceBVH(scatteredRay, scene, hitPosition, hitNormal, meshIndex))
+				for (int u = std::max(0, x - 1); u <= std::min(width - 1, x + 1); u++)
 				{
+					error = std::max(error, errors[v * width + u]);
+				}
+			}
+			bool active = renderImage.sampleCount(x, y) < maxSamples && error > params.errorThreshold;
+			pixelSamples[i] = active ? 1 : 0;
+			activeCount += pixelSamples[i];
+		}
+		// Don't start a pass that would overrun the budget by more than its last sample
+		size_t samples = std::min(passSamples, (budget - used) / std::max(1, activeCount));
+		if (activeCount == 0 || samples == 0) break;
+		// Pixels close to maxSamples only get what they have left
+		long long passCount = 0;
+		#pragma omp parallel for reduction(+:passCount)
+		for (int i = 0; i < int(pixelCount); i++)
+		{
+			if (pixelSamples[i] == 0) continue;
+			size_t sampleCount = renderImage.sampleCount(i % width, i / width);
+			pixelSamples[i] = uint32_t(std::min(samples, maxSamples - sampleCount));
+			passCount += pixelSamples[i];
+		}
 
-					// Direct Illumination
-					MaterialPtr hitMat = scene.meshes()[meshIndex].material();
-					if (hitMat->type == Material::EMISSIVE)
-					{
-						totalColorResponse += hitMat->colorResponse(hitPosition, hitNormal, Vec3f(0.f), Vec3f(0.f));
-						continue;
-					}
+		renderPass(scene, renderImage, params, sampler, samples, &pixelSamples);
+		used += size_t(passCount);
+		renderImage.resolve();
+		if (params.flushInterval > 0.f && std::chrono::duration<float>(Clock::now() - lastFlush).count() >= params.flushInterval)
+		{
+			renderImage.savePNG(params.flushFile.c_str());
+			lastFlush = Clock::now();
+		}
+	}
+	fprintf(stderr, "\rAdaptive rendering : %.2f samples per pixel on average (%llu camera rays) in %.2fs ",
+		double(used) / pixelCount, (unsigned long long)used, std::chrono::duration<float>(Clock::now() - start).count());
+}
+
+//renders sampleCount more samples of each pixel, or pixelSamples[pixel] if given, into the accumulation buffer of the image
+void RayTracer::renderPass(const Scene& scene, Image& renderImage, const RenderParams& params, const Sampler& samplerPrototype, size_t sampleCount, const std::vector<uint32_t>* pixelSamples)
+{
+	if (params.wavefront)
+	{
+		WavefrontRenderer(scene, params, samplerPrototype).renderPass(renderImage, sampleCount, pixelSamples);
+		return;
+	}
 
-					Vec3f direct = evalDirect(hitPosition, hitNormal, hitMat, scene);	
+	const Camera& renderCam = scene.camera();
+	int width = renderImage.getWidth(); 
+	int height = renderImage.getHeight();
+	TileScheduler scheduler(width, height, params.tileSize, params.tileOrder, omp_get_max_threads());
+
+	// Display progress in percentage from a single thread, woken up early when the pass is over
+	int passSamples = int(sampleCount);
+	std::mutex progressLock;
+	std::condition_variable passDone;
+	bool finished = false;
+	std::thread progress([&]()
+	{
+		std::unique_lock<std::mutex> lock(progressLock);
+		while (!passDone.wait_for(lock, std::chrono::milliseconds(100), [&]() { return finished; }))
+		{
+			fprintf(stderr, "\rRendering (+%i samples): %.2f%% ", passSamples, (double)scheduler.tilesDone() / scheduler.tileCount() * 100);
+		}
+		fprintf(stderr, "\rRendering (+%i samples): 100.00%% ", passSamples);
+	});
 
-					// Indirect Illumination
-					// Vec3f indirect = tracePath(hitPosition, hitNormal, hitMat, 1, scene);
+	#pragma omp parallel
+	{
+		// Samples only depend on the pixel and sample index : the image doesn't depend on the thread schedule
+		SamplerPtr sampler = samplerPrototype.clone();
+		std::vector<Vec3f> tileColors;
+		std::vector<double> tileSquares;
+		Tile tile;
+		while (scheduler.next(omp_get_thread_num(), tile))
+		{
+			// Accumulate the tile locally, then add it to the image in one go
+			int tileWidth = tile.x1 - tile.x0;
+			tileColors.assign(tileWidth * (tile.y1 - tile.y0), Vec3f(0, 0, 0));
+			tileSquares.assign(tileColors.size(), 0.0);
+			// Camera rays of kPacketSide x kPacketSide pixel blocks are traced together, one sample index at a time
+			int blockSide = params.packets ? kPacketSide : 1;
+			for (int by = tile.y0; by < tile.y1; by += blockSide)
+			{
+				for (int bx = tile.x0; bx < tile.x1; bx += blockSide)
+				{
+					for (int k = 0; k < int(sampleCount); k++)
+					{
+						Ray cameraRays[BVH::kPacketSize];
+						int rayPixels[BVH::kPacketSize][3];
+						int rayCount = 0;
+						for (int y = by; y < std::min(by + blockSide, tile.y1); y++)
+						{
+							for (int x = bx; x < std::min(bx + blockSide, tile.x1); x++)
+							{
+								if (pixelSamples && k >= int((*pixelSamples)[y * width + x])) continue;
+								// Pixel sampling
+								int sampleIndex = int(renderImage.sampleCount(x, y)) + k;
+								sampler->startPixelSample(x, y, sampleIndex);
+								float rd_width, rd_height;
+								sampler->get2D(rd_width, rd_height);
+								cameraRays[rayCount] = renderCam.rayAt((float(x) + rd_width)/ width, 1.f - (float(y) + rd_height)/height);
+								rayPixels[rayCount][0] = x;
+								rayPixels[rayCount][1] = y;
+								rayPixels[rayCount][2] = sampleIndex;
+								rayCount++;
+							}
+						}
+						hitInfo primaryHits[BVH::kPacketSize];
+						if (params.packets) scene.getBVHroot().hit(cameraRays, rayCount, primaryHits, scene.meshes());
 
-					// Final gathering
-					totalColorResponse += direct;
+						for (int r = 0; r < rayCount; r++)
+						{
+							int x = rayPixels[r][0], y = rayPixels[r][1];
+							// Continue the sample after the two pixel dimensions
+							sampler->resumePixelSample(x, y, rayPixels[r][2], 2);
+							Vec3f sampleColor = pathTrace(cameraRays[r], scene, params, *sampler, params.packets ? &primaryHits[r] : nullptr);
+							tileColors[(y - tile.y0) * tileWidth + (x - tile.x0)] += sampleColor;
+							double luminance = Image::luminance(sampleColor);
+							tileSquares[(y - tile.y0) * tileWidth + (x - tile.x0)] += luminance * luminance;
+						}
+					}
+				}
+			}
+			for (int y = tile.y0; y < tile.y1; y++)
+			{
+				for (int x = tile.x0; x < tile.x1; x++)
+				{
+					uint32_t pixelSampleCount = pixelSamples ? (*pixelSamples)[y * width + x] : uint32_t(sampleCount);
+					if (pixelSampleCount == 0) continue;
+					int index = (y - tile.y0) * tileWidth + (x - tile.x0);
+					renderImage.accumulate(x, y, tileColors[index], tileSquares[index], pixelSampleCount);
 				}
 			}
-			renderImage(x, y) = totalColorResponse / float(rayPerPixel);
+			scheduler.tileDone();
 		}
 	}
+	{
+		std::lock_guard<std::mutex> lock(progressLock);
+		finished = true;
+	}
+	passDone.notify_one();
+	progress.join();
 }
 
-Vec3f RayTracer::tracePath(const Vec3f& origin, const Vec3f& normal, MaterialPtr material, size_t nBounces, const Scene& scene)
+Vec3f RayTracer::pathTrace(const Ray& cameraRay, const Scene& scene, const RenderParams& params, Sampler& sampler, const hitInfo* primaryHit)
 {
-	Vec3f indirect{};
-	for (int i = 0; i < 5; ++i)
+	Vec3f radiance(0.f);
+	Vec3f throughput(1.f);
+	Ray ray = cameraRay;
+	// Previous vertex and density of the direction that left it, to weight the emission found by the BSDF sample
+	Vec3f previousPosition, previousNormal;
+	float bsdfPdf = 0.f;
+	for (size_t depth = 0; ; depth++)
 	{
-		float rdX = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-		float rdY = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-		float pdf;
-		Vec3f randomDirection = GeometryHelper::sampleCosineHemisphereConcentric(rdX, rdY, normal, pdf);
-		Ray reflectionRay = Ray(origin + 0.01f * normal, normalize(randomDirection));
-		Vec3f hitPosition, hitNormal; size_t hitMesh;
-		if (rayTraceBVH(reflectionRay, scene, hitPosition, hitNormal, hitMesh))
+		hitInfo hitRecord;
+		if (depth == 0 && primaryHit) hitRecord = *primaryHit;
+		else scene.getBVHroot().hit(ray, hitRecord, scene.meshes());
+		if (hitRecord.meshIndex == size_t(-1)) break;
+		Vec3f hitPosition, hitNormal;
+		hitSurface(hitRecord, scene, hitPosition, hitNormal);
+
+		// Emission seen from the camera, or reached by a BSDF sample and weighted against the light sample of the previous vertex
+		const MaterialData& hitMat = scene.material(hitRecord.meshIndex);
+		if (hitMat.type == Material::EMISSIVE)
 		{
-			MaterialPtr hitMat = scene.meshes()[hitMesh].material();
-			Vec3f hitDirect = evalDirect(hitPosition, hitNormal, hitMat, scene);
-			indirect += hitDirect / pdf * material->colorResponse(origin, normal, normalize(hitPosition - origin), origin);
+			Vec3f emitted = hitMat.colorResponse(hitPosition, hitNormal, Vec3f(0.f), Vec3f(0.f));
+			if (depth == 0) radiance += emitted;
+			else radiance += throughput * emitted * misWeight(bsdfPdf, kEmissiveSamples * lightPdf(scene, previousPosition, previousNormal, hitRecord.meshIndex, hitRecord.triangle, hitPosition));
+			break;
 		}
+		// The last BSDF sample is only traced to find lights
+		if (depth > params.bounces) break;
+
+		// Shade the side the ray comes from
+		if (dot(hitNormal, ray.m_direction) > 0.f) hitNormal = -hitNormal;
+
+		// Next event estimation
+		radiance += throughput * evalDirect(hitPosition, hitNormal, ray.m_origin, hitMat, scene, true, sampler);
+
+		// Continue the path in a direction sampled from the material
+		float uLobe = sampler.get1D();
+		float rdX, rdY;
+		sampler.get2D(rdX, rdY);
+		Vec3f direction;
+		if (!hitMat.sampleDirection(hitPosition, hitNormal, ray.m_origin, uLobe, rdX, rdY, direction)) break;
+		bsdfPdf = hitMat.pdf(hitPosition, hitNormal, direction, ray.m_origin);
+		if (bsdfPdf <= 0.f) break;
+		throughput *= hitMat.colorResponse(hitPosition, hitNormal, direction, ray.m_origin) / bsdfPdf;
+
+		// Russian roulette : paths carrying little energy are stopped, the survivors are weighted up to stay unbiased
+		if (depth + 1 >= params.rouletteDepth)
+		{
+			float survival = std::min(0.95f, std::max(throughput[0], std::max(throughput[1], throughput[2])));
+			if (sampler.get1D() >= survival) break;
+			throughput /= survival;
+		}
+		previousPosition = hitPosition;
+		previousNormal = hitNormal;
+		ray = Ray(hitPosition + 0.0001f * hitNormal, direction);
 	}
-	return indirect / 5.0f;
+	return radiance;
 }
 
 // Raytrace the scene with a given ray (loop over all triangles)
@@ -93,7 +319,9 @@ bool RayTracer::rayTrace(const Ray& ray, const Scene& scene, Vec3f& intersection
 
 			// Test intersection
 			Vec3f barCoord; float parT;
-			if (ray.testTriangleIntersection(trianglePositions, barCoord, parT))
+			bool triangleIntersect = scene.watertight() ? ray.testTriangleIntersectionWatertight(trianglePositions, barCoord, parT)
+				: ray.testTriangleIntersection(trianglePositions, barCoord, parT);
+			if (triangleIntersect)
 			{
 				// z buffer test				
 				if (parT >0 && zmax > parT)
@@ -116,99 +344,115 @@ bool RayTracer::rayTrace(const Ray& ray, const Scene& scene, Vec3f& intersection
 bool RayTracer::rayTraceBVH(const Ray& ray, const Scene& scene, Vec3f& intersectionPos, Vec3f& intersectionNormal, size_t& meshIndex)
 { 
 	// Init
-	bool intersectFound = false;
 	const BVHroot& root = scene.getBVHroot();
 	hitInfo hitRecord;	
 
-	if (root.hit(ray, hitRecord, scene.meshes()))
-	{
-		intersectFound = true;
-		meshIndex = hitRecord.meshIndex;				
-		Vec3i triangleIndices = hitRecord.triangleIndices;		
-		const Mesh& sceneMesh = scene.meshes()[meshIndex];
-		const std::vector<Vec3f>& vertices = sceneMesh.vertices();
-		const std::vector<Vec3f>& normals = sceneMesh.normals();
-
-		// Return intersection position and normal by interpoling using barycentric coordinates
-		intersectionPos = sceneMesh.interpPos(hitRecord.barCoord, triangleIndices);
-		intersectionNormal = sceneMesh.interpNorm(hitRecord.barCoord, triangleIndices);
-	}
+	if (!root.hit(ray, hitRecord, scene.meshes())) return false;
+	meshIndex = hitRecord.meshIndex;
+	hitSurface(hitRecord, scene, intersectionPos, intersectionNormal);
+	return true;
+}
 
-	return intersectFound;
+void RayTracer::hitSurface(const hitInfo& hitRecord, const Scene& scene, Vec3f& intersectionPos, Vec3f& intersectionNormal)
+{
+	const Mesh& sceneMesh = scene.meshes()[hitRecord.meshIndex];
+
+	// Return intersection position and normal by interpoling using barycentric coordinates
+	intersectionPos = sceneMesh.interpPos(hitRecord.barCoord, hitRecord.triangleIndices);
+	intersectionNormal = sceneMesh.interpNorm(hitRecord.barCoord, hitRecord.triangleIndices);
 }
 
-Vec3f sampleMeshUniformly(const Mesh& mesh, Vec3f& normal)
+// Shadow ray test : stops at the first occluder found within the ray interval
+bool RayTracer::occluded(const Ray& ray, const Scene& scene)
 {
-	if (mesh.indices().size() == 0) return Vec3f{};
+	return scene.getBVHroot().occluded(ray, scene.meshes());
+}
 
-	size_t rdIndex = size_t(GeometryHelper::random(0, mesh.indices().size() - 1));
-	auto& rdTri = mesh.triangle(mesh.indices()[rdIndex]);
-	normal = GeometryHelper::computeTriangleNormal(rdTri);
-	return GeometryHelper::sampleTriangleUniformly(rdTri);
+bool RayTracer::sampleEmissive(const Vec3f& position, const Vec3f& normal, const Vec3f& viewPoint, const MaterialData& mat, const Scene& scene, bool bsdfSampling, Sampler& sampler, LightSample& sample)
+{
+	// Pick an emissive triangle according to its contribution estimated by the light BVH, or else its power, then a point on it
+	float u = sampler.get1D();
+	float r1, r2;
+	sampler.get2D(r1, r2);
+	EmissiveSample light;
+	bool found = scene.lightBVH().empty() ? scene.lightSampler().sample(scene.meshes(), u, r1, r2, light)
+		: scene.lightBVH().sample(scene.meshes(), position, normal, u, r1, r2, light);
+	if (!found) return false;
+
+	// Convert the area density to a solid angle density at the shading point, lights emit on both sides
+	Vec3f toLight = light.position - position;
+	float squaredDistance = dot(toLight, toLight);
+	if (squaredDistance <= 0.f) return false;
+	Vec3f direction = toLight / std::sqrt(squaredDistance);
+	float lightCosine = std::abs(dot(light.normal, direction));
+	if (lightCosine <= 0.f) return false;
+	float pdf = light.pdfArea * squaredDistance / lightCosine;
+
+	Vec3f shadowOrigin = position + 0.0001f * normal;
+	// Stop just before the sampled point so that the light itself isn't an occluder
+	sample.shadowRay = Ray(shadowOrigin, direction, 0.f, 0.999f * (light.position - shadowOrigin).length());
+	Vec3f emitted = scene.material(light.meshIndex).colorResponse(light.position, light.normal, Vec3f(0.0f), Vec3f(0.0f));
+	// The BSDF sample of the path can reach the same light, see pathTrace
+	float weight = bsdfSampling ? misWeight(kEmissiveSamples * pdf, mat.pdf(position, normal, direction, viewPoint)) : 1.f;
+	sample.contribution = emitted * mat.colorResponse(position, normal, direction, viewPoint) * (weight / pdf);
+	return true;
 }
 
+float RayTracer::lightPdf(const Scene& scene, const Vec3f& position, const Vec3f& normal, size_t meshIndex, int triangleIndex, const Vec3f& lightPosition)
+{
+	const Mesh& mesh = scene.meshes()[meshIndex];
+	Vec3<Vec3f> triangle = mesh.triangle(mesh.indices()[triangleIndex]);
+	float pdfArea = scene.lightBVH().empty() ? scene.lightSampler().pdfArea(scene.material(meshIndex))
+		: scene.lightBVH().pmf(position, normal, meshIndex, triangleIndex) / GeometryHelper::computeTriangleArea(triangle);
+	Vec3f toLight = lightPosition - position;
+	float squaredDistance = dot(toLight, toLight);
+	float lightCosine = std::abs(dot(GeometryHelper::computeTriangleNormal(triangle), toLight)) / std::sqrt(squaredDistance);
+	return lightCosine > 0.f ? pdfArea * squaredDistance / lightCosine : 0.f;
+}
 
-Vec3f RayTracer::evalDirect(const Vec3f& position, const Vec3f& normal, MaterialPtr mat, const Scene& scene)
+Vec3f RayTracer::evalDirect(const Vec3f& position, const Vec3f& normal, const Vec3f& viewPoint, const MaterialData& mat, const Scene& scene, bool bsdfSampling, Sampler& sampler)
 {
 	// Init
 	const std::vector<lightPtr>& lights = scene.lightSources();	
 	const size_t kAnalyticalSamples = 0;
-	const size_t kEmissiveSamples = 1;
 	Vec3f analytical{}, emissive{};
 
 	// Analytical lights
 	for (int i = 0; i < lights.size(); ++i)
 	{
 		// Shadow Test
-		Vec3f lightPos = lights[i]->getPosition();
+		float rd1, rd2;
+		sampler.get2D(rd1, rd2);
+		Vec3f lightPos = lights[i]->samplePosition(rd1, rd2);
 		Vec3f direction = normalize(lightPos - position);
-		Ray shadowRay = Ray(position, direction);
-		Vec3f shadowInterPos, shadowInterNormal; size_t shadowMeshIndex;
+		Ray shadowRay = Ray(position, direction, 0.f, (lightPos - position).length());
 
 		// If occluded
-		if (RayTracer::rayTraceBVH(shadowRay, scene, shadowInterPos, shadowInterNormal, shadowMeshIndex))
+		if (RayTracer::occluded(shadowRay, scene))
 		{
 			continue;
 		}
 
 		// Else shade based on light properties
-		analytical += lights[i]->colorResponse() * M_1_PI * mat->colorResponse(position, normal, direction, scene.camera().getPosition());
+		analytical += lights[i]->colorResponse() * M_1_PI * mat.colorResponse(position, normal, direction, viewPoint);
 	}
 
 	// Emissive Triangles
-	for (int i = 0; i < scene.emissiveMeshes().size(); ++i)
+	if (scene.lightSampler().empty()) return emissive;
+	for (int k = 0; k < int(kEmissiveSamples); ++k)
 	{
-		for (int k = 0; k < kEmissiveSamples; ++k)
-		{
-			size_t index = scene.emissiveMeshes()[i];
-			Mesh emissiveMesh = scene.meshes()[index];
-
-			// Safety net
-			if (emissiveMesh.material()->type != Material::EMISSIVE)
-			{
-				std::cerr << "Should not be here" << std::endl;
-				continue;
-			}
-
-			// Sample Mesh and test visibility
-			Vec3f sampledNorm;
-			Vec3f sampledPos = sampleMeshUniformly(emissiveMesh, sampledNorm);
-
-			Vec3f direction = normalize(sampledPos - position);
-			Ray shadowRay = Ray(position - 0.0001f* direction, normalize(sampledPos - position));
-			Vec3f shadowInterPos, shadowInterNormal; size_t shadowMeshIndex;
+		LightSample sample;
+		if (!sampleEmissive(position, normal, viewPoint, mat, scene, bsdfSampling, sampler, sample)) continue;
 
-			// If occluded
-			//if (RayTracer::rayTraceBVH(shadowRay, scene, shadowInterPos, shadowInterNormal, shadowMeshIndex))
-			//{
-			//	if(shadowMeshIndex != index)
-			//	continue;
-			//}
-
-			// Shade using mesh light
-			emissive += emissiveMesh.material()->colorResponse(sampledPos, normal, Vec3f(0.0f), Vec3f(0.0f)) * mat->colorResponse(position, normal, direction, scene.camera().getPosition());
+		// If occluded
+		if (RayTracer::occluded(sample.shadowRay, scene))
+		{
+			continue;
 		}
+
+		// Shade using mesh light
+		emissive += sample.contribution;
 	}
 
-	return  emissive;
+	return  emissive / float(kEmissiveSamples);
 }
@@ -3,22 +3,90 @@
 #include"image.h"
 #include"scene.h"
 #include"GeometryHelper.h"
+#include"sampler.h"
+#include"tileScheduler.h"
+
+// Rendering settings
+struct RenderParams
+{
+	size_t rayPerPixel = 8;
+	size_t bounces = 0;                                  // indirect bounces after the first hit, 0 for direct lighting only
+	size_t rouletteDepth = 3;                            // bounces before Russian roulette starts
+	int tileSize = 16;                                   // side of the square tiles handed to the threads
+	TileScheduler::Order tileOrder = TileScheduler::HILBERT;
+	// Progressive mode : rayPerPixel is the target, 0 to only stop on the time budget
+	bool progressive = false;
+	size_t samplesPerPass = 1;
+	float timeBudget = 0.f;                              // seconds, 0 for no limit
+	float flushInterval = 0.f;                           // seconds between intermediate images, 0 to disable
+	std::string flushFile = "test.png";
+	// Adaptive mode : the rayPerPixel * pixels budget goes to the pixels whose error is above the threshold
+	bool adaptive = false;
+	size_t minSamples = 0;                               // samples of every pixel before the error is trusted, 0 for rayPerPixel / 4
+	size_t maxSamples = 0;                               // cap per pixel, 0 for 8 * rayPerPixel
+	float errorThreshold = 0.03f;                        // standard error of the mean luminance over the square root of the mean
+	std::string heatMapFile;                             // sample count heat map, empty to disable
+	// Wavefront mode : paths advance one bounce at a time in batches of waveSize paths (see WavefrontRenderer)
+	bool wavefront = false;
+	size_t waveSize = 1 << 18;
+	// Trace camera rays (and in wavefront mode the first shadow rays) as packets through the BVH
+	bool packets = true;
+	// Wavefront mode : sort the rays of the bounces by origin and direction before tracing them
+	bool sortRays = false;
+};
+
+// Light sample for next event estimation : the contribution is added if the shadow ray is unoccluded
+struct LightSample
+{
+	Ray shadowRay;
+	Vec3f contribution;
+};
 
 class RayTracer
 {
 	public:		
-		static void render(const Scene& scene, Image& image, size_t rayPerPixel, size_t bounces);
+		// Shadow rays towards the emissive triangles per shading point
+		static const size_t kEmissiveSamples = 1;
+		// Side of the pixel blocks whose camera rays form a packet
+		static const int kPacketSide = 8;
+
+
+		static void render(const Scene& scene, Image& image, const RenderParams& params, const Sampler& sampler);
+
+		// Adds sampleCount samples to every pixel, or pixelSamples[y * width + x] (at most sampleCount) to each pixel if given.
+		// Each pixel continues its own sample sequence
+		static void renderPass(const Scene& scene, Image& image, const RenderParams& params, const Sampler& sampler, size_t sampleCount, const std::vector<uint32_t>* pixelSamples = nullptr);
+
+		static void renderProgressive(const Scene& scene, Image& image, const RenderParams& params, const Sampler& sampler);
+
+		static void renderAdaptive(const Scene& scene, Image& image, const RenderParams& params, const Sampler& sampler);
 
 		static bool rayTrace(const Ray& ray, const Scene& scene, Vec3f& intersectionPos, Vec3f& intersectionNormal, size_t& meshIndex);		
 
 		static bool rayTraceBVH(const Ray& ray, const Scene& scene, Vec3f& intersectionPos, Vec3f& intersectionNormal, size_t& meshIndex);	
 
-		static Vec3f evalDirect(const Vec3f& position, const Vec3f& normal, MaterialPtr mat, const Scene& scene);
+		// Interpolated position and normal of a BVH hit
+		static void hitSurface(const hitInfo& hitRecord, const Scene& scene, Vec3f& intersectionPos, Vec3f& intersectionNormal);
 
-		static Vec3f pathTrace(const Ray& ray, size_t current, const Scene& scene, size_t maxBounces);
+		static bool occluded(const Ray& ray, const Scene& scene);
 
-		static Vec3f pathTrace(const Ray& ray, int depth, const Scene& scene);
+		// Samples a point on the emissive triangles of the scene (see LightBVH and LightSampler) for the light reflected towards viewPoint.
+		// The contribution is divided by the solid angle pdf, and weighted against the BSDF sampling of pathTrace if bsdfSampling is set.
+		// False if there is no light or the sample can't reach the shading point
+		static bool sampleEmissive(const Vec3f& position, const Vec3f& normal, const Vec3f& viewPoint, const MaterialData& mat, const Scene& scene, bool bsdfSampling, Sampler& sampler, LightSample& sample);
 
-		static Vec3f tracePath(const Vec3f& origin, const Vec3f& normal, MaterialPtr material, size_t nBounces, const Scene& scene);
-};
+		// Solid angle density of sampleEmissive choosing a point of the triangleIndex-th triangle of an emissive mesh from the shading point
+		static float lightPdf(const Scene& scene, const Vec3f& position, const Vec3f& normal, size_t meshIndex, int triangleIndex, const Vec3f& lightPosition);
 
+		// Power heuristic weight of a sample from the strategy of density pdf against the other one (Veach 1995)
+		static inline float misWeight(float pdf, float otherPdf) { return pdf * pdf / (pdf * pdf + otherPdf * otherPdf); }
+
+		// Light reflected towards viewPoint by emissive triangles, bsdfSampling as in sampleEmissive
+		static Vec3f evalDirect(const Vec3f& position, const Vec3f& normal, const Vec3f& viewPoint, const MaterialData& mat, const Scene& scene, bool bsdfSampling, Sampler& sampler);
+
+		// Radiance along a camera ray : iterative path with next event estimation at every vertex, combined with the BSDF samples
+		// by multiple importance sampling.
+		// primaryHit is the closest hit of the camera ray when it has already been traced (size_t(-1) mesh index for a miss)
+		static Vec3f pathTrace(const Ray& ray, const Scene& scene, const RenderParams& params, Sampler& sampler, const hitInfo* primaryHit = nullptr);
+};
+static_assert(RayTracer::kPacketSide * RayTracer::kPacketSide <= BVH::kPacketSize, "A block of pixels should fit in one packet");
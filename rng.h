@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+
+/// <summary>
+/// PCG32 random number generator (O'Neill 2014) : 64 bits of state, 32 bits output.
+/// Each sequence index selects an independent stream, so a generator can be created per pixel
+/// and the image doesn't depend on which thread renders which pixel.
+/// </summary>
+class RNG
+{
+public:
+	static const uint64_t kDefaultSeed = 0x853c49e6748fea9bULL;
+
+	inline RNG(uint64_t sequenceIndex = 0, uint64_t seed = kDefaultSeed) { setSequence(sequenceIndex, seed); }
+
+	inline void setSequence(uint64_t sequenceIndex, uint64_t seed = kDefaultSeed)
+	{
+		m_state = 0u;
+		m_inc = (sequenceIndex << 1u) | 1u;
+		nextUInt();
+		m_state += seed;
+		nextUInt();
+	}
+
+	inline uint32_t nextUInt()
+	{
+		uint64_t oldState = m_state;
+		m_state = oldState * 0x5851f42d4c957f2dULL + m_inc;
+		uint32_t xorShifted = uint32_t(((oldState >> 18u) ^ oldState) >> 27u);
+		uint32_t rot = uint32_t(oldState >> 59u);
+		return (xorShifted >> rot) | (xorShifted << ((~rot + 1u) & 31));
+	}
+
+	// Skip the next delta numbers of the sequence in O(log delta)
+	inline void advance(uint64_t delta)
+	{
+		uint64_t curMult = 0x5851f42d4c957f2dULL, curPlus = m_inc;
+		uint64_t accMult = 1u, accPlus = 0u;
+		while (delta > 0)
+		{
+			if (delta & 1)
+			{
+				accMult *= curMult;
+				accPlus = accPlus * curMult + curPlus;
+			}
+			curPlus = (curMult + 1) * curPlus;
+			curMult *= curMult;
+			delta /= 2;
+		}
+		m_state = accMult * m_state + accPlus;
+	}
+
+	// Uniform integer in [0, bound[ without modulo bias
+	inline uint32_t nextUInt(uint32_t bound)
+	{
+		uint32_t threshold = (~bound + 1u) % bound;
+		while (true)
+		{
+			uint32_t r = nextUInt();
+			if (r >= threshold) return r % bound;
+		}
+	}
+
+	// Uniform float in [0, 1[
+	inline float nextFloat()
+	{
+		// 2^-32, clamped so that rounding can't give 1
+		float r = float(nextUInt()) * 2.3283064365386963e-10f;
+		return r < 0.99999994f ? r : 0.99999994f;
+	}
+
+	// Uniform float in [min, max[
+	inline float nextFloat(float min, float max)
+	{
+		return min + (max - min) * nextFloat();
+	}
+
+private:
+	uint64_t m_state;
+	uint64_t m_inc;
+};
@@ -0,0 +1,223 @@
+#include "sampler.h"
+
+namespace
+{
+	// 32 bits integer hash (lowbias32)
+	inline uint32_t mixBits(uint32_t x)
+	{
+		x ^= x >> 16;
+		x *= 0x7feb352du;
+		x ^= x >> 15;
+		x *= 0x846ca68bu;
+		x ^= x >> 16;
+		return x;
+	}
+
+	inline uint32_t hashCombine(uint32_t seed, uint32_t value)
+	{
+		return seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+	}
+
+	inline uint32_t hashPixel(int x, int y, int dimension, uint32_t seed)
+	{
+		return mixBits(hashCombine(hashCombine(hashCombine(mixBits(seed), uint32_t(x)), uint32_t(y)), uint32_t(dimension)));
+	}
+
+	// Maps 32 bits to [0, 1[
+	inline float toFloat(uint32_t x)
+	{
+		float r = float(x) * 2.3283064365386963e-10f;
+		return r < 0.99999994f ? r : 0.99999994f;
+	}
+
+	inline float fract(float x)
+	{
+		return x - float(int(x));
+	}
+
+	inline uint32_t reverseBits(uint32_t x)
+	{
+		x = (x << 16) | (x >> 16);
+		x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+		x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+		x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+		x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+		return x;
+	}
+
+	// Hash that only propagates bits upwards, i.e. a random nested uniform scramble of the reversed bits (Laine-Karras)
+	inline uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed)
+	{
+		x += seed;
+		x ^= x * 0x6c50b47cu;
+		x ^= x * 0xb82f1e52u;
+		x ^= x * 0xc7afe638u;
+		x ^= x * 0x8d22f6e6u;
+		return x;
+	}
+
+	inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+	{
+		return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+	}
+
+	// First two dimensions of the Sobol' sequence : van der Corput, then the (x + 1) polynomial
+	inline uint32_t sobol0(uint32_t index)
+	{
+		return reverseBits(index);
+	}
+
+	inline uint32_t sobol1(uint32_t index)
+	{
+		uint32_t result = 0;
+		for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+		{
+			if (index & 1u) result ^= v;
+		}
+		return result;
+	}
+
+	const int kPrimeCount = 64;
+	const int kPrimes[kPrimeCount] = {
+		2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+		59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+		137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+		227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311 };
+
+	inline float radicalInverse(int base, uint32_t index)
+	{
+		double invBase = 1.0 / base, invBaseN = 1.0;
+		uint64_t reversed = 0;
+		while (index != 0)
+		{
+			uint32_t next = index / base;
+			uint32_t digit = index - next * base;
+			reversed = reversed * base + digit;
+			invBaseN *= invBase;
+			index = next;
+		}
+		float r = float(reversed * invBaseN);
+		return r < 0.99999994f ? r : 0.99999994f;
+	}
+
+	// Interleaved gradient noise (Jimenez 2014) : per pixel values in [0, 1[ with little low frequency content
+	inline float interleavedGradientNoise(float x, float y)
+	{
+		return fract(52.9829189f * fract(0.06711056f * x + 0.00583715f * y));
+	}
+
+	// Offset of a pixel for one dimension. Only the image plane pair uses the gradient noise : sharing it with
+	// the following dimensions correlates them within the pixel (light sample and triangle choice) and biases the estimate
+	inline float pixelOffset(int x, int y, int dimension, uint32_t seed)
+	{
+		if (dimension == 0) return interleavedGradientNoise(float(x), float(y));
+		if (dimension == 1) return interleavedGradientNoise(float(x) + 5.588238f, float(y) + 5.588238f);
+		return toFloat(hashPixel(x, y, dimension, seed));
+	}
+}
+
+SamplerPtr Sampler::create(Type type, uint32_t seed)
+{
+	switch (type)
+	{
+		case SOBOL: return SamplerPtr(new SobolSampler(seed));
+		case HALTON: return SamplerPtr(new HaltonSampler(seed));
+		case RANK1: return SamplerPtr(new Rank1Sampler(seed));
+		default: return SamplerPtr(new IndependentSampler(seed));
+	}
+}
+
+bool Sampler::parseType(const std::string& name, Type& type)
+{
+	if (name == "independent") type = INDEPENDENT;
+	else if (name == "sobol") type = SOBOL;
+	else if (name == "halton") type = HALTON;
+	else if (name == "rank1") type = RANK1;
+	else return false;
+	return true;
+}
+
+void Sampler::startPixelSample(int x, int y, int sampleIndex)
+{
+	m_x = x;
+	m_y = y;
+	m_sampleIndex = sampleIndex;
+	m_dimension = 0;
+}
+
+void IndependentSampler::startPixelSample(int x, int y, int sampleIndex)
+{
+	Sampler::startPixelSample(x, y, sampleIndex);
+	m_rng.setSequence((uint64_t(uint32_t(y)) << 32) | uint32_t(x), mixBits(hashCombine(m_seed, uint32_t(sampleIndex))));
+}
+
+// One random number per dimension
+void IndependentSampler::skipDimensions(int count)
+{
+	m_rng.advance(uint64_t(count));
+	m_dimension += count;
+}
+
+float IndependentSampler::get1D()
+{
+	m_dimension++;
+	return m_rng.nextFloat();
+}
+
+void IndependentSampler::get2D(float& u, float& v)
+{
+	m_dimension += 2;
+	u = m_rng.nextFloat();
+	v = m_rng.nextFloat();
+}
+
+float SobolSampler::get1D()
+{
+	uint32_t seed = hashPixel(m_x, m_y, m_dimension++, m_seed);
+	uint32_t index = nestedUniformScramble(uint32_t(m_sampleIndex), seed);
+	return toFloat(nestedUniformScramble(sobol0(index), hashCombine(seed, 0)));
+}
+
+void SobolSampler::get2D(float& u, float& v)
+{
+	uint32_t seed = hashPixel(m_x, m_y, m_dimension, m_seed);
+	m_dimension += 2;
+	// Shuffling the index differently for each pair keeps the pairs from being correlated
+	uint32_t index = nestedUniformScramble(uint32_t(m_sampleIndex), seed);
+	u = toFloat(nestedUniformScramble(sobol0(index), hashCombine(seed, 0)));
+	v = toFloat(nestedUniformScramble(sobol1(index), hashCombine(seed, 1)));
+}
+
+float HaltonSampler::get1D()
+{
+	int dimension = m_dimension++;
+	if (dimension >= kPrimeCount) return toFloat(hashPixel(m_x, m_y, dimension, hashCombine(m_seed, uint32_t(m_sampleIndex))));
+	float rotation = toFloat(hashPixel(m_x, m_y, dimension, m_seed));
+	return fract(radicalInverse(kPrimes[dimension], uint32_t(m_sampleIndex)) + rotation);
+}
+
+void HaltonSampler::get2D(float& u, float& v)
+{
+	u = get1D();
+	v = get1D();
+}
+
+float Rank1Sampler::get1D()
+{
+	// Golden ratio sequence, in 32 bits fixed point so that it stays exact for large sample indices
+	const uint32_t alpha = 0x9e3779b9u;
+	float offset = pixelOffset(m_x, m_y, m_dimension++, m_seed);
+	return fract(offset + toFloat(alpha * uint32_t(m_sampleIndex)));
+}
+
+void Rank1Sampler::get2D(float& u, float& v)
+{
+	// R2 sequence : 1/g and 1/g^2 with g the plastic number, in 32 bits fixed point
+	const uint32_t alpha1 = 0xc13fa9a9u;
+	const uint32_t alpha2 = 0x91e10da5u;
+	float offsetU = pixelOffset(m_x, m_y, m_dimension, m_seed);
+	float offsetV = pixelOffset(m_x, m_y, m_dimension + 1, m_seed);
+	m_dimension += 2;
+	u = fract(offsetU + toFloat(alpha1 * uint32_t(m_sampleIndex)));
+	v = fract(offsetV + toFloat(alpha2 * uint32_t(m_sampleIndex)));
+}
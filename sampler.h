@@ -0,0 +1,105 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <cstdint>
+#include "rng.h"
+
+class Sampler;
+typedef std::shared_ptr<Sampler> SamplerPtr;
+
+/// <summary>
+/// Source of the uniform numbers used by the renderer. A sample of a pixel is a point in a
+/// multidimensional unit cube : each call to get1D / get2D consumes the next dimension(s), in the same
+/// order for every sample (pixel jitter, then light sampling, then each bounce...).
+/// Samplers keep per sample state, each thread works on its own clone.
+/// </summary>
+class Sampler
+{
+	public:
+		enum Type
+		{
+			INDEPENDENT, // uniform random numbers
+			SOBOL,       // Owen scrambled Sobol' (0,2) pairs
+			HALTON,      // Halton with a random per pixel rotation
+			RANK1,       // R2 rank-1 lattice with blue-ish per pixel offsets
+		};
+
+		virtual ~Sampler() {}
+		static SamplerPtr create(Type type, uint32_t seed = 0);
+		static bool parseType(const std::string& name, Type& type);
+
+		virtual SamplerPtr clone() const = 0;
+		// Start the sampleIndex-th sample of pixel (x, y), dimensions restart at 0
+		virtual void startPixelSample(int x, int y, int sampleIndex);
+		// Resume a sample at a given dimension, for renderers that process a sample in several steps
+		inline void resumePixelSample(int x, int y, int sampleIndex, int dimension) { startPixelSample(x, y, sampleIndex); skipDimensions(dimension); }
+		inline int dimension() const { return m_dimension; }
+		virtual float get1D() = 0;
+		virtual void get2D(float& u, float& v) = 0;
+
+	protected:
+		inline Sampler(uint32_t seed) : m_seed(seed) {}
+		virtual void skipDimensions(int count) { m_dimension += count; }
+		uint32_t m_seed;
+		int m_x = 0;
+		int m_y = 0;
+		int m_sampleIndex = 0;
+		int m_dimension = 0;
+};
+
+class IndependentSampler : public Sampler
+{
+	public:
+		inline IndependentSampler(uint32_t seed = 0) : Sampler(seed) {}
+		SamplerPtr clone() const { return SamplerPtr(new IndependentSampler(*this)); }
+		void startPixelSample(int x, int y, int sampleIndex);
+		float get1D();
+		void get2D(float& u, float& v);
+
+	protected:
+		void skipDimensions(int count);
+
+	private:
+		RNG m_rng;
+};
+
+/// <summary>
+/// Sobol' points with hash based Owen scrambling (Burley 2020, "Practical Hash-based Owen Scrambling").
+/// Only the first two Sobol' dimensions are used : every pair of dimensions gets its own scrambling seed
+/// and its own shuffle of the sample index, which decorrelates the pairs. Best with power of 2 sample counts.
+/// </summary>
+class SobolSampler : public Sampler
+{
+	public:
+		inline SobolSampler(uint32_t seed = 0) : Sampler(seed) {}
+		SamplerPtr clone() const { return SamplerPtr(new SobolSampler(*this)); }
+		float get1D();
+		void get2D(float& u, float& v);
+};
+
+/// <summary>
+/// Halton sequence (radical inverse in the first primes), randomized per pixel and per dimension by
+/// a Cranley-Patterson rotation. Dimensions past the prime table fall back to hashed random numbers.
+/// </summary>
+class HaltonSampler : public Sampler
+{
+	public:
+		inline HaltonSampler(uint32_t seed = 0) : Sampler(seed) {}
+		SamplerPtr clone() const { return SamplerPtr(new HaltonSampler(*this)); }
+		float get1D();
+		void get2D(float& u, float& v);
+};
+
+/// <summary>
+/// Rank-1 lattice following the R2 generalized golden ratio sequence (Roberts 2018), rotated per pixel.
+/// The image plane rotation comes from interleaved gradient noise, so that neighbouring pixels get well spread
+/// jitter and the aliasing looks like high frequency (blue-ish) noise. Other dimensions use hashed rotations.
+/// </summary>
+class Rank1Sampler : public Sampler
+{
+	public:
+		inline Rank1Sampler(uint32_t seed = 0) : Sampler(seed) {}
+		SamplerPtr clone() const { return SamplerPtr(new Rank1Sampler(*this)); }
+		float get1D();
+		void get2D(float& u, float& v);
+};
@@ -2,10 +2,13 @@
 #include<vector>
 #include<fstream>
 #include<string>
+#include<unordered_map>
 #include <omp.h>
 #include "Vec3.h"
 #include "mesh.h"
 #include "BVHnode.h"
+#include "lightSampler.h"
+#include "lightBVH.h"
 
 class BSHnode;
 
@@ -16,23 +19,58 @@ class Scene
 		std::vector<Mesh> m_meshes;	
 		std::vector<lightPtr> m_lights;		
 		std::vector<size_t> m_emissiveMeshesIndicies;
+		// Materials shared by several meshes have a single entry
+		std::vector<MaterialData> m_materials;
+		std::vector<MaterialId> m_materialIds;
+		LightSampler m_lightSampler;
+		LightBVH m_lightBVH;
 		BVHroot m_root;
+		BVHBuildParams m_bvhParams;
+		inline void updateLights(size_t meshIndex)
+		{
+			if (material(meshIndex).type != Material::EMISSIVE) return;
+			m_lightSampler = LightSampler(m_meshes, m_materials, m_materialIds);
+			if (!m_lightBVH.empty()) m_lightBVH = LightBVH(m_meshes, m_materials, m_materialIds);
+		}
 	public:
 		Scene(Camera _cam, std::vector<Mesh> _mesh, std::vector<lightPtr> _lights) : m_cam(_cam), m_meshes(_mesh), m_lights(_lights) 
 		{
+			std::unordered_map<const Material*, MaterialId> materialIds;
 			for (size_t i = 0; i < m_meshes.size(); ++i)
 			{
-				if (m_meshes[i].material()->type == Material::EMISSIVE)
+				const Material* material = m_meshes[i].material().get();
+				auto entry = materialIds.find(material);
+				if (entry == materialIds.end())
+				{
+					entry = materialIds.emplace(material, MaterialId(m_materials.size())).first;
+					m_materials.push_back(material->data());
+				}
+				m_materialIds.push_back(entry->second);
+				if (m_materials[entry->second].type == Material::EMISSIVE)
 				{
 					m_emissiveMeshesIndicies.push_back(i);
 				}
 			}
+			m_lightSampler = LightSampler(m_meshes, m_materials, m_materialIds);
 		};		
-		inline void computeBVH() { m_root = BVHroot(m_meshes); }
+		inline void computeBVH(const BVHBuildParams& params = BVHBuildParams()) { m_bvhParams = params; m_root = BVHroot(m_meshes, params); m_lightBVH = params.lightBVH ? LightBVH(m_meshes, m_materials, m_materialIds) : LightBVH(); }
+		inline float bvhCost() const { return m_root.sahCost(m_bvhParams); }
+		inline bool watertight() const { return m_bvhParams.watertight; }
+		// Move a mesh after computeBVH : its BVH is kept and only the top level is rebuilt
+		inline void translateMesh(size_t meshIndex, const Vec3f& translation) { m_meshes[meshIndex].translate(translation); m_root.translateMesh(meshIndex, translation); updateLights(meshIndex); }
+		inline void scaleMesh(size_t meshIndex, float scale) { m_meshes[meshIndex].scale(scale); m_root.scaleMesh(meshIndex, scale); updateLights(meshIndex); }
 		inline const BVHroot& getBVHroot() const { return m_root; }
 		inline const Camera& camera() const { return m_cam; }		
 		inline const std::vector<lightPtr>& lightSources() const { return m_lights; }
 		inline const std::vector<size_t>& emissiveMeshes() const { return m_emissiveMeshesIndicies; }
+		// Power weighted selection of the emissive triangles, kept up to date by translateMesh and scaleMesh
+		inline const LightSampler& lightSampler() const { return m_lightSampler; }
+		// Built by computeBVH unless disabled in the BVH parameters, empty otherwise
+		inline const LightBVH& lightBVH() const { return m_lightBVH; }
 		inline const std::vector<Mesh>& meshes() const { return m_meshes; }
+		// Flat material table built from the mesh materials, indexed by the material id of each mesh
+		inline const std::vector<MaterialData>& materials() const { return m_materials; }
+		inline MaterialId materialId(size_t meshIndex) const { return m_materialIds[meshIndex]; }
+		inline const MaterialData& material(size_t meshIndex) const { return m_materials[m_materialIds[meshIndex]]; }
 };
 
@@ -0,0 +1,19 @@
+#pragma once
+
+// Instruction sets available at compile time (/arch:AVX2 with MSVC, -mavx2 with GCC/Clang).
+// Defining SIMD_SCALAR keeps only the portable code paths, to compare against them or to debug
+#if !defined(SIMD_SCALAR)
+#if defined(__AVX2__)
+#define SIMD_AVX2 1
+#endif
+#if defined(__AVX__) || defined(__AVX2__)
+#define SIMD_AVX 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE 1
+#endif
+#endif
+
+#if defined(SIMD_SSE) || defined(SIMD_AVX)
+#include <immintrin.h>
+#endif
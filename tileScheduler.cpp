@@ -0,0 +1,117 @@
+#include "tileScheduler.h"
+#include <algorithm>
+#include <cstdint>
+
+namespace
+{
+	// Spread the 16 low bits of x to the even bits
+	inline uint32_t spreadBits(uint32_t x)
+	{
+		x &= 0x0000ffffu;
+		x = (x | (x << 8)) & 0x00ff00ffu;
+		x = (x | (x << 4)) & 0x0f0f0f0fu;
+		x = (x | (x << 2)) & 0x33333333u;
+		x = (x | (x << 1)) & 0x55555555u;
+		return x;
+	}
+
+	inline uint32_t mortonIndex(uint32_t x, uint32_t y)
+	{
+		return spreadBits(x) | (spreadBits(y) << 1);
+	}
+
+	// Distance of (x, y) along the Hilbert curve covering a n x n grid, n a power of 2
+	inline uint32_t hilbertIndex(uint32_t n, uint32_t x, uint32_t y)
+	{
+		uint32_t d = 0;
+		for (uint32_t s = n / 2; s > 0; s /= 2)
+		{
+			uint32_t rx = (x & s) > 0 ? 1 : 0;
+			uint32_t ry = (y & s) > 0 ? 1 : 0;
+			d += s * s * ((3 * rx) ^ ry);
+			// Rotate the quadrant
+			if (ry == 0)
+			{
+				if (rx == 1)
+				{
+					x = s - 1 - x;
+					y = s - 1 - y;
+				}
+				std::swap(x, y);
+			}
+		}
+		return d;
+	}
+}
+
+TileScheduler::TileScheduler(int width, int height, int tileSize, Order order, int threadCount) : m_queues(std::max(1, threadCount)), m_tilesDone(0)
+{
+	tileSize = std::max(1, tileSize);
+	int tilesX = (width + tileSize - 1) / tileSize;
+	int tilesY = (height + tileSize - 1) / tileSize;
+	uint32_t gridSize = 1;
+	while (gridSize < uint32_t(std::max(tilesX, tilesY))) gridSize *= 2;
+	std::vector<std::pair<uint32_t, Tile>> keyedTiles;
+	keyedTiles.reserve(tilesX * tilesY);
+	for (int ty = 0; ty < tilesY; ty++)
+	{
+		for (int tx = 0; tx < tilesX; tx++)
+		{
+			Tile tile = { tx * tileSize, ty * tileSize, std::min(width, (tx + 1) * tileSize), std::min(height, (ty + 1) * tileSize) };
+			uint32_t key = uint32_t(ty * tilesX + tx);
+			if (order == MORTON) key = mortonIndex(tx, ty);
+			else if (order == HILBERT) key = hilbertIndex(gridSize, tx, ty);
+			keyedTiles.push_back(std::make_pair(key, tile));
+		}
+	}
+	std::sort(keyedTiles.begin(), keyedTiles.end(), [](const std::pair<uint32_t, Tile>& a, const std::pair<uint32_t, Tile>& b) { return a.first < b.first; });
+	m_tiles.resize(keyedTiles.size());
+	for (int i = 0; i < int(keyedTiles.size()); i++) m_tiles[i] = keyedTiles[i].second;
+	// One contiguous range of the curve per thread
+	int queueCount = int(m_queues.size());
+	for (int q = 0; q < queueCount; q++)
+	{
+		int begin = int(int64_t(m_tiles.size()) * q / queueCount);
+		int end = int(int64_t(m_tiles.size()) * (q + 1) / queueCount);
+		for (int i = begin; i < end; i++) m_queues[q].m_tiles.push_back(i);
+	}
+}
+
+bool TileScheduler::parseOrder(const std::string& name, Order& order)
+{
+	if (name == "scanline") order = SCANLINE;
+	else if (name == "morton") order = MORTON;
+	else if (name == "hilbert") order = HILBERT;
+	else return false;
+	return true;
+}
+
+bool TileScheduler::next(int thread, Tile& tile)
+{
+	int queueCount = int(m_queues.size());
+	thread %= queueCount;
+	// Own queue first, from the front so that consecutive tiles stay close on the curve
+	{
+		TileQueue& queue = m_queues[thread];
+		std::lock_guard<std::mutex> guard(queue.m_lock);
+		if (!queue.m_tiles.empty())
+		{
+			tile = m_tiles[queue.m_tiles.front()];
+			queue.m_tiles.pop_front();
+			return true;
+		}
+	}
+	// Steal from the back of the other queues, far from where their owner is working
+	for (int i = 1; i < queueCount; i++)
+	{
+		TileQueue& queue = m_queues[(thread + i) % queueCount];
+		std::lock_guard<std::mutex> guard(queue.m_lock);
+		if (!queue.m_tiles.empty())
+		{
+			tile = m_tiles[queue.m_tiles.back()];
+			queue.m_tiles.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
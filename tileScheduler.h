@@ -0,0 +1,48 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <string>
+
+// Rectangle of pixels [x0, x1[ x [y0, y1[
+struct Tile
+{
+	int x0, y0, x1, y1;
+};
+
+/// <summary>
+/// Splits an image into square tiles ordered along a space filling curve. The curve is cut into one contiguous
+/// range per thread, so that each thread starts on its own region of the image, then threads that run out of
+/// tiles steal from the far end of another thread's range.
+/// </summary>
+class TileScheduler
+{
+	public:
+		enum Order
+		{
+			SCANLINE,
+			MORTON,
+			HILBERT,
+		};
+
+		TileScheduler(int width, int height, int tileSize, Order order, int threadCount);
+		static bool parseOrder(const std::string& name, Order& order);
+
+		// Next tile for the given thread, false once every tile has been handed out
+		bool next(int thread, Tile& tile);
+		inline void tileDone() { m_tilesDone++; }
+		inline int tilesDone() const { return m_tilesDone; }
+		inline int tileCount() const { return int(m_tiles.size()); }
+
+	private:
+		struct TileQueue
+		{
+			std::mutex m_lock;
+			std::deque<int> m_tiles;
+		};
+
+		std::vector<Tile> m_tiles;
+		std::vector<TileQueue> m_queues;
+		std::atomic<int> m_tilesDone;
+};
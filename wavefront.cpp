@@ -0,0 +1,608 @@
+#include "wavefront.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace
+{
+	// Stable parallel compaction : indices i in [0, count[ for which keep(i) is true, in increasing order.
+	// Each thread compacts a contiguous range, the ranges are then concatenated with a prefix sum
+	template<typename Predicate>
+	void compact(int count, Predicate keep, std::vector<int>& output)
+	{
+		std::vector<int> offsets(omp_get_max_threads() + 1, 0);
+		int threadCount = 1;
+		output.resize(count);
+		#pragma omp parallel
+		{
+			int thread = omp_get_thread_num();
+			int threads = omp_get_num_threads();
+			int begin = int(int64_t(count) * thread / threads);
+			int end = int(int64_t(count) * (thread + 1) / threads);
+			int kept = 0;
+			for (int i = begin; i < end; i++) kept += keep(i) ? 1 : 0;
+			offsets[thread + 1] = kept;
+			#pragma omp barrier
+			#pragma omp single
+			{
+				threadCount = threads;
+				for (int t = 0; t < threads; t++) offsets[t + 1] += offsets[t];
+			}
+			int out = offsets[thread];
+			for (int i = begin; i < end; i++)
+			{
+				if (keep(i)) output[out++] = i;
+			}
+		}
+		output.resize(offsets[threadCount]);
+	}
+
+	// Spread the 10 low bits of x to every third bit
+	inline uint32_t spreadBits3(uint32_t x)
+	{
+		x &= 0x000003ffu;
+		x = (x | (x << 16)) & 0x030000ffu;
+		x = (x | (x << 8)) & 0x0300f00fu;
+		x = (x | (x << 4)) & 0x030c30c3u;
+		x = (x | (x << 2)) & 0x09249249u;
+		return x;
+	}
+
+	// Direction octant in the 3 high bits, then the Morton code of the origin quantized to 9 bits per axis
+	inline uint32_t rayKey(const float origin[3], const float direction[3], const Vec3f& boundsMin, const Vec3f& boundsScale)
+	{
+		uint32_t key = 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float cell = (origin[axis] - boundsMin[axis]) * boundsScale[axis];
+			uint32_t q = uint32_t(std::min(511.f, std::max(0.f, cell)));
+			key |= spreadBits3(q) << axis;
+			if (direction[axis] < 0.f) key |= 1u << (27 + axis);
+		}
+		return key;
+	}
+
+	// Stable LSD radix sort of order by keys[order[i]], 30 bit keys in 3 passes of 10 bits
+	void radixSort(const std::vector<uint32_t>& keys, std::vector<int>& order, std::vector<int>& scratch)
+	{
+		const int kBits = 10;
+		const int kBuckets = 1 << kBits;
+		std::vector<int> counts(kBuckets);
+		scratch.resize(order.size());
+		for (int shift = 0; shift < 30; shift += kBits)
+		{
+			std::fill(counts.begin(), counts.end(), 0);
+			for (int i : order) counts[(keys[i] >> shift) & (kBuckets - 1)]++;
+			int offset = 0;
+			for (int b = 0; b < kBuckets; b++)
+			{
+				int count = counts[b];
+				counts[b] = offset;
+				offset += count;
+			}
+			for (int i : order) scratch[counts[(keys[i] >> shift) & (kBuckets - 1)]++] = i;
+			order.swap(scratch);
+		}
+	}
+}
+
+void WavefrontRenderer::RayQueue::resize(size_t size)
+{
+	for (int c = 0; c < 3; c++)
+	{
+		m_origin[c].resize(size);
+		m_direction[c].resize(size);
+	}
+	m_tMax.resize(size);
+	m_path.resize(size);
+}
+
+void WavefrontRenderer::RayQueue::set(int i, const Ray& ray, int path)
+{
+	for (int c = 0; c < 3; c++)
+	{
+		m_origin[c][i] = ray.m_origin[c];
+		m_direction[c][i] = ray.m_direction[c];
+	}
+	m_tMax[i] = ray.m_tMax;
+	m_path[i] = path;
+}
+
+void WavefrontRenderer::PathStates::resize(size_t size)
+{
+	m_pixel.resize(size);
+	m_sampleIndex.resize(size);
+	m_dimension.resize(size);
+	for (int c = 0; c < 3; c++)
+	{
+		m_throughput[c].resize(size);
+		m_radiance[c].resize(size);
+		m_previousPosition[c].resize(size);
+		m_previousNormal[c].resize(size);
+	}
+	m_bsdfPdf.resize(size);
+}
+
+void WavefrontRenderer::HitQueue::resize(size_t size)
+{
+	for (int c = 0; c < 3; c++)
+	{
+		m_position[c].resize(size);
+		m_normal[c].resize(size);
+	}
+	m_mesh.resize(size);
+	m_triangle.resize(size);
+}
+
+void WavefrontRenderer::ShadowQueue::resize(size_t size)
+{
+	m_rays.resize(size);
+	for (int c = 0; c < 3; c++) m_contribution[c].resize(size);
+	m_valid.resize(size);
+}
+
+WavefrontRenderer::WavefrontRenderer(const Scene& scene, const RenderParams& params, const Sampler& sampler) : m_scene(scene), m_params(params), m_sampler(sampler), m_width(0), m_height(0)
+{
+}
+
+void WavefrontRenderer::renderPass(Image& image, size_t sampleCount, const std::vector<uint32_t>* pixelSamples)
+{
+	m_width = int(image.getWidth());
+	m_height = int(image.getHeight());
+	m_pixels.clear();
+	m_pathOffsets.assign(1, 0);
+	for (int i = 0; i < m_width * m_height; i++)
+	{
+		int count = pixelSamples ? int((*pixelSamples)[i]) : int(sampleCount);
+		if (count == 0) continue;
+		m_pixels.push_back(i);
+		m_pathOffsets.push_back(m_pathOffsets.back() + count);
+	}
+
+	// Waves of whole pixels, so that the samples of a pixel are accumulated together
+	int waveSize = int(std::max<size_t>(1, m_params.waveSize));
+	int pixelCount = 0;
+	for (int firstPixel = 0; firstPixel < int(m_pixels.size()); firstPixel += pixelCount)
+	{
+		fprintf(stderr, "\rRendering (+%i samples): %.2f%% ", int(sampleCount), 100.0 * firstPixel / m_pixels.size());
+		pixelCount = 1;
+		while (firstPixel + pixelCount < int(m_pixels.size()) && m_pathOffsets[firstPixel + pixelCount + 1] - m_pathOffsets[firstPixel] <= waveSize) pixelCount++;
+		generateCameraRays(image, firstPixel, pixelCount);
+		for (size_t depth = 0; m_rays.m_path.size() > 0; depth++)
+		{
+			intersect(depth);
+			sortByMaterial();
+			shadeEmissive(depth);
+			// The last scattered rays are only traced to find lights
+			if (depth > m_params.bounces) break;
+			sampleLights();
+			traceShadowRays(depth);
+			addDirectLighting();
+			scatter(depth);
+			if (m_params.sortRays) sortRays();
+		}
+		accumulate(image, firstPixel, pixelCount);
+	}
+	fprintf(stderr, "\rRendering (+%i samples): 100.00%% (bounces %.2f Mrays/s, shadows %.2f Mrays/s) ", int(sampleCount),
+		m_bounceTime > 0 ? m_bounceRays / m_bounceTime * 1e-6 : 0.0, m_shadowTime > 0 ? m_shadowRays / m_shadowTime * 1e-6 : 0.0);
+}
+
+// One path per pixel sample, the samples of a pixel are consecutive
+void WavefrontRenderer::generateCameraRays(const Image& image, int firstPixel, int pixelCount)
+{
+	int firstPath = m_pathOffsets[firstPixel];
+	int pathCount = m_pathOffsets[firstPixel + pixelCount] - firstPath;
+	m_paths.resize(pathCount);
+	m_rays.resize(pathCount);
+	const Camera& camera = m_scene.camera();
+	#pragma omp parallel
+	{
+		SamplerPtr sampler = m_sampler.clone();
+		#pragma omp for
+		for (int path = 0; path < pathCount; path++)
+		{
+			// Pixel of the path in the wave
+			int p = int(std::upper_bound(m_pathOffsets.begin() + firstPixel, m_pathOffsets.begin() + firstPixel + pixelCount + 1, firstPath + path) - m_pathOffsets.begin()) - 1;
+			int pixel = m_pixels[p];
+			int x = pixel % m_width, y = pixel / m_width;
+			// Continue the sample sequence of the pixel, as RayTracer::renderPass
+			int sampleIndex = int(image.sampleCount(x, y)) + firstPath + path - m_pathOffsets[p];
+			m_paths.m_pixel[path] = pixel;
+			m_paths.m_sampleIndex[path] = sampleIndex;
+			sampler->startPixelSample(x, y, sampleIndex);
+			float rd_width, rd_height;
+			sampler->get2D(rd_width, rd_height);
+			m_rays.set(path, camera.rayAt((float(x) + rd_width) / m_width, 1.f - (float(y) + rd_height) / m_height), path);
+			m_paths.m_dimension[path] = sampler->dimension();
+			for (int c = 0; c < 3; c++)
+			{
+				m_paths.m_throughput[c][path] = 1.f;
+				m_paths.m_radiance[c][path] = 0.f;
+			}
+		}
+	}
+}
+
+void WavefrontRenderer::intersect(size_t depth)
+{
+	int count = int(m_rays.m_path.size());
+	m_hits.resize(count);
+	// Camera rays of consecutive paths are coherent enough for packets, later bounces aren't
+	int packetSize = m_params.packets && depth == 0 ? BVH::kPacketSize : 1;
+	int packetCount = (count + packetSize - 1) / packetSize;
+	double start = omp_get_wtime();
+	#pragma omp parallel for schedule(dynamic, 64 / packetSize + 1)
+	for (int p = 0; p < packetCount; p++)
+	{
+		int begin = p * packetSize;
+		int size = std::min(packetSize, count - begin);
+		Ray rays[BVH::kPacketSize];
+		hitInfo hitRecords[BVH::kPacketSize];
+		for (int r = 0; r < size; r++) rays[r] = m_rays.ray(begin + r);
+		if (size > 1) m_scene.getBVHroot().hit(rays, size, hitRecords, m_scene.meshes());
+		else m_scene.getBVHroot().hit(rays[0], hitRecords[0], m_scene.meshes());
+		for (int r = 0; r < size; r++)
+		{
+			int i = begin + r;
+			if (hitRecords[r].meshIndex == size_t(-1))
+			{
+				m_hits.m_mesh[i] = -1;
+				continue;
+			}
+			Vec3f position, normal;
+			RayTracer::hitSurface(hitRecords[r], m_scene, position, normal);
+			for (int c = 0; c < 3; c++)
+			{
+				m_hits.m_position[c][i] = position[c];
+				m_hits.m_normal[c][i] = normal[c];
+			}
+			m_hits.m_mesh[i] = int(hitRecords[r].meshIndex);
+			m_hits.m_triangle[i] = hitRecords[r].triangle;
+		}
+	}
+	if (depth > 0)
+	{
+		m_bounceRays += count;
+		m_bounceTime += omp_get_wtime() - start;
+	}
+}
+
+// Misses end their path, the hits are split by material so that each shading kernel only sees its own material
+void WavefrontRenderer::sortByMaterial()
+{
+	int count = int(m_rays.m_path.size());
+	compact(count, [&](int i) { return m_hits.m_mesh[i] >= 0 && m_scene.material(m_hits.m_mesh[i]).type == Material::EMISSIVE; }, m_emissiveQueue);
+	compact(count, [&](int i) { return m_hits.m_mesh[i] >= 0 && m_scene.material(m_hits.m_mesh[i]).type != Material::EMISSIVE; }, m_surfaceQueue);
+}
+
+// Emission seen from the camera, or reached by a BSDF sample and weighted as in RayTracer::pathTrace
+void WavefrontRenderer::shadeEmissive(size_t depth)
+{
+	#pragma omp parallel for
+	for (int q = 0; q < int(m_emissiveQueue.size()); q++)
+	{
+		int i = m_emissiveQueue[q];
+		int path = m_rays.m_path[i];
+		Vec3f position(m_hits.m_position[0][i], m_hits.m_position[1][i], m_hits.m_position[2][i]);
+		Vec3f normal(m_hits.m_normal[0][i], m_hits.m_normal[1][i], m_hits.m_normal[2][i]);
+		Vec3f emission = m_scene.material(m_hits.m_mesh[i]).colorResponse(position, normal, Vec3f(0.f), Vec3f(0.f));
+		Vec3f radiance = m_paths.radiance(path);
+		if (depth == 0) radiance += emission;
+		else
+		{
+			Vec3f previousPosition(m_paths.m_previousPosition[0][path], m_paths.m_previousPosition[1][path], m_paths.m_previousPosition[2][path]);
+			Vec3f previousNormal(m_paths.m_previousNormal[0][path], m_paths.m_previousNormal[1][path], m_paths.m_previousNormal[2][path]);
+			float lightPdf = RayTracer::lightPdf(m_scene, previousPosition, previousNormal, size_t(m_hits.m_mesh[i]), m_hits.m_triangle[i], position);
+			radiance += m_paths.throughput(path) * emission * RayTracer::misWeight(m_paths.m_bsdfPdf[path], RayTracer::kEmissiveSamples * lightPdf);
+		}
+		for (int c = 0; c < 3; c++) m_paths.m_radiance[c][path] = radiance[c];
+	}
+}
+
+// Fills the shadow queue with RayTracer::kEmissiveSamples light samples per shaded hit
+void WavefrontRenderer::sampleLights()
+{
+	int slots = lightSlots();
+	int count = int(m_surfaceQueue.size());
+	m_shadows.resize(size_t(count) * slots);
+	#pragma omp parallel
+	{
+		SamplerPtr sampler = m_sampler.clone();
+		#pragma omp for
+		for (int q = 0; q < count; q++)
+		{
+			int i = m_surfaceQueue[q];
+			int path = m_rays.m_path[i];
+			Vec3f position(m_hits.m_position[0][i], m_hits.m_position[1][i], m_hits.m_position[2][i]);
+			Vec3f normal(m_hits.m_normal[0][i], m_hits.m_normal[1][i], m_hits.m_normal[2][i]);
+			// Shade the side the ray comes from, the flipped normal is kept for scattering
+			Vec3f direction(m_rays.m_direction[0][i], m_rays.m_direction[1][i], m_rays.m_direction[2][i]);
+			Vec3f origin(m_rays.m_origin[0][i], m_rays.m_origin[1][i], m_rays.m_origin[2][i]);
+			if (dot(normal, direction) > 0.f)
+			{
+				normal = -normal;
+				for (int c = 0; c < 3; c++) m_hits.m_normal[c][i] = normal[c];
+			}
+			int pixel = m_paths.m_pixel[path];
+			sampler->resumePixelSample(pixel % m_width, pixel / m_width, m_paths.m_sampleIndex[path], m_paths.m_dimension[path]);
+			const MaterialData& mat = m_scene.material(m_hits.m_mesh[i]);
+
+			// Analytical lights aren't part of the RayTracer::evalDirect estimate, only their dimensions are consumed
+			for (size_t l = 0; l < m_scene.lightSources().size(); l++)
+			{
+				float rd1, rd2;
+				sampler->get2D(rd1, rd2);
+			}
+			for (int k = 0; k < slots; k++)
+			{
+				int slot = q * slots + k;
+				LightSample sample;
+				m_shadows.m_valid[slot] = RayTracer::sampleEmissive(position, normal, origin, mat, m_scene, true, *sampler, sample) ? 1 : 0;
+				if (!m_shadows.m_valid[slot]) continue;
+				m_shadows.m_rays.set(slot, sample.shadowRay, path);
+				for (int c = 0; c < 3; c++) m_shadows.m_contribution[c][slot] = sample.contribution[c];
+			}
+			m_paths.m_dimension[path] = sampler->dimension();
+		}
+	}
+}
+
+void WavefrontRenderer::traceShadowRays(size_t depth)
+{
+	int count = int(m_shadows.m_valid.size());
+	const BVHroot& root = m_scene.getBVHroot();
+	if (depth == 0 && m_params.packets)
+	{
+		// Packets of the k-th shadow rays of neighbouring camera hits
+		int slots = lightSlots();
+		int hitCount = int(m_surfaceQueue.size());
+		int packetsPerSlot = (hitCount + BVH::kPacketSize - 1) / BVH::kPacketSize;
+		#pragma omp parallel for schedule(dynamic, 1)
+		for (int p = 0; p < packetsPerSlot * slots; p++)
+		{
+			int slot = p / packetsPerSlot;
+			int begin = (p % packetsPerSlot) * BVH::kPacketSize;
+			int end = std::min(hitCount, begin + BVH::kPacketSize);
+			Ray rays[BVH::kPacketSize];
+			int entries[BVH::kPacketSize];
+			int size = 0;
+			for (int q = begin; q < end; q++)
+			{
+				int i = q * slots + slot;
+				if (!m_shadows.m_valid[i]) continue;
+				rays[size] = m_shadows.m_rays.ray(i);
+				entries[size++] = i;
+			}
+			uint64_t occluded = root.occluded(rays, size, m_scene.meshes());
+			for (int r = 0; r < size; r++)
+			{
+				if (occluded & (uint64_t(1) << r)) m_shadows.m_valid[entries[r]] = 0;
+			}
+		}
+		return;
+	}
+
+	double start = omp_get_wtime();
+	compact(count, [&](int i) { return m_shadows.m_valid[i] != 0; }, m_order);
+	// Sorted shadow rays are coherent enough to go through the BVH as packets
+	if (m_params.sortRays) sortOrder(m_shadows.m_rays, m_order);
+	int rayCount = int(m_order.size());
+	int packetSize = m_params.sortRays && m_params.packets ? BVH::kPacketSize : 1;
+	int packetCount = (rayCount + packetSize - 1) / packetSize;
+	#pragma omp parallel for schedule(dynamic, 64 / packetSize + 1)
+	for (int p = 0; p < packetCount; p++)
+	{
+		int begin = p * packetSize;
+		int size = std::min(packetSize, rayCount - begin);
+		Ray rays[BVH::kPacketSize];
+		for (int r = 0; r < size; r++) rays[r] = m_shadows.m_rays.ray(m_order[begin + r]);
+		uint64_t occluded = 0;
+		if (size > 1) occluded = root.occluded(rays, size, m_scene.meshes());
+		else if (root.occluded(rays[0], m_scene.meshes())) occluded = 1;
+		for (int r = 0; r < size; r++)
+		{
+			if (occluded & (uint64_t(1) << r)) m_shadows.m_valid[m_order[begin + r]] = 0;
+		}
+	}
+	m_shadowRays += rayCount;
+	m_shadowTime += omp_get_wtime() - start;
+}
+
+// Sums the unoccluded light samples of each hit in order, so that the result matches RayTracer::evalDirect
+void WavefrontRenderer::addDirectLighting()
+{
+	int slots = lightSlots();
+	#pragma omp parallel for
+	for (int q = 0; q < int(m_surfaceQueue.size()); q++)
+	{
+		int path = m_rays.m_path[m_surfaceQueue[q]];
+		Vec3f emissive{};
+		for (int slot = q * slots; slot < (q + 1) * slots; slot++)
+		{
+			if (m_shadows.m_valid[slot]) emissive += Vec3f(m_shadows.m_contribution[0][slot], m_shadows.m_contribution[1][slot], m_shadows.m_contribution[2][slot]);
+		}
+		Vec3f radiance = m_paths.radiance(path) + m_paths.throughput(path) * (emissive / float(RayTracer::kEmissiveSamples));
+		for (int c = 0; c < 3; c++) m_paths.m_radiance[c][path] = radiance[c];
+	}
+}
+
+// Continues the paths of the shaded hits, the survivors form the ray queue of the next bounce.
+// Directions are sampled per path, then the BSDF and its density are evaluated by batches of kShadingBatchSize hits
+void WavefrontRenderer::scatter(size_t depth)
+{
+	int count = int(m_surfaceQueue.size());
+	m_nextRays.resize(count);
+	m_roulette.resize(count);
+	#pragma omp parallel
+	{
+		SamplerPtr sampler = m_sampler.clone();
+		#pragma omp for
+		for (int q = 0; q < count; q++)
+		{
+			int i = m_surfaceQueue[q];
+			int path = m_rays.m_path[i];
+			m_nextRays.m_path[q] = -1;
+			Vec3f position(m_hits.m_position[0][i], m_hits.m_position[1][i], m_hits.m_position[2][i]);
+			Vec3f normal(m_hits.m_normal[0][i], m_hits.m_normal[1][i], m_hits.m_normal[2][i]);
+			Vec3f origin(m_rays.m_origin[0][i], m_rays.m_origin[1][i], m_rays.m_origin[2][i]);
+			int pixel = m_paths.m_pixel[path];
+			sampler->resumePixelSample(pixel % m_width, pixel / m_width, m_paths.m_sampleIndex[path], m_paths.m_dimension[path]);
+
+			const MaterialData& mat = m_scene.material(m_hits.m_mesh[i]);
+			float uLobe = sampler->get1D();
+			float rdX, rdY;
+			sampler->get2D(rdX, rdY);
+			Vec3f direction;
+			if (!mat.sampleDirection(position, normal, origin, uLobe, rdX, rdY, direction)) continue;
+			// Drawn now to keep the sample dimensions in the order of RayTracer::pathTrace
+			m_roulette[q] = depth + 1 >= m_params.rouletteDepth ? sampler->get1D() : 0.f;
+			m_paths.m_dimension[path] = sampler->dimension();
+			for (int c = 0; c < 3; c++) m_nextRays.m_direction[c][q] = direction[c];
+			m_nextRays.m_path[q] = path;
+		}
+	}
+
+	// The surface queue only holds GGX materials, see sortByMaterial
+	int batchCount = (count + kShadingBatchSize - 1) / kShadingBatchSize;
+	#pragma omp parallel for
+	for (int b = 0; b < batchCount; b++)
+	{
+		GGXBatch batch;
+		for (int lane = 0; lane < kShadingBatchSize; lane++)
+		{
+			int q = b * kShadingBatchSize + lane;
+			bool active = q < count && m_nextRays.m_path[q] >= 0;
+			int i = active ? m_surfaceQueue[q] : 0;
+			Vec3f wo;
+			if (active)
+			{
+				Vec3f position(m_hits.m_position[0][i], m_hits.m_position[1][i], m_hits.m_position[2][i]);
+				Vec3f origin(m_rays.m_origin[0][i], m_rays.m_origin[1][i], m_rays.m_origin[2][i]);
+				wo = normalize(origin - position);
+			}
+			batch.m_material[lane] = active ? &m_scene.material(m_hits.m_mesh[i]) : nullptr;
+			for (int c = 0; c < 3; c++)
+			{
+				batch.m_normal[c][lane] = active ? m_hits.m_normal[c][i] : 0.f;
+				batch.m_wo[c][lane] = wo[c];
+				batch.m_wi[c][lane] = active ? m_nextRays.m_direction[c][q] : 0.f;
+			}
+		}
+		evalGGX8(batch);
+
+		for (int lane = 0; lane < kShadingBatchSize; lane++)
+		{
+			int q = b * kShadingBatchSize + lane;
+			if (q >= count || m_nextRays.m_path[q] < 0) continue;
+			int i = m_surfaceQueue[q];
+			int path = m_nextRays.m_path[q];
+			m_nextRays.m_path[q] = -1;
+			float pdf = batch.m_pdf[lane];
+			if (pdf <= 0.f) continue;
+			Vec3f throughput = m_paths.throughput(path);
+			throughput *= Vec3f(batch.m_color[0][lane], batch.m_color[1][lane], batch.m_color[2][lane]) / pdf;
+
+			// Russian roulette
+			if (depth + 1 >= m_params.rouletteDepth)
+			{
+				float survival = std::min(0.95f, std::max(throughput[0], std::max(throughput[1], throughput[2])));
+				if (m_roulette[q] >= survival) continue;
+				throughput /= survival;
+			}
+			Vec3f position(m_hits.m_position[0][i], m_hits.m_position[1][i], m_hits.m_position[2][i]);
+			Vec3f normal(m_hits.m_normal[0][i], m_hits.m_normal[1][i], m_hits.m_normal[2][i]);
+			Vec3f direction(m_nextRays.m_direction[0][q], m_nextRays.m_direction[1][q], m_nextRays.m_direction[2][q]);
+			for (int c = 0; c < 3; c++)
+			{
+				m_paths.m_throughput[c][path] = throughput[c];
+				m_paths.m_previousPosition[c][path] = position[c];
+				m_paths.m_previousNormal[c][path] = normal[c];
+			}
+			m_paths.m_bsdfPdf[path] = pdf;
+			m_nextRays.set(q, Ray(position + 0.0001f * normal, direction), path);
+		}
+	}
+
+	std::vector<int> alive;
+	compact(count, [&](int q) { return m_nextRays.m_path[q] >= 0; }, alive);
+	m_rays.resize(alive.size());
+	#pragma omp parallel for
+	for (int r = 0; r < int(alive.size()); r++)
+	{
+		int q = alive[r];
+		for (int c = 0; c < 3; c++)
+		{
+			m_rays.m_origin[c][r] = m_nextRays.m_origin[c][q];
+			m_rays.m_direction[c][r] = m_nextRays.m_direction[c][q];
+		}
+		m_rays.m_tMax[r] = m_nextRays.m_tMax[q];
+		m_rays.m_path[r] = m_nextRays.m_path[q];
+	}
+}
+
+// Sorts the ray indices of order by origin Morton code and direction octant
+void WavefrontRenderer::sortOrder(const RayQueue& rays, std::vector<int>& order)
+{
+	// Origins quantized over the scene bounds
+	const AABB& bounds = m_scene.getBVHroot().boundingBox();
+	Vec3f extent = bounds.max() - bounds.min();
+	Vec3f scale;
+	for (int axis = 0; axis < 3; axis++) scale[axis] = extent[axis] > 0.f ? 512.f / extent[axis] : 0.f;
+	m_keys.resize(rays.m_path.size());
+	#pragma omp parallel for
+	for (int k = 0; k < int(order.size()); k++)
+	{
+		int i = order[k];
+		float origin[3] = { rays.m_origin[0][i], rays.m_origin[1][i], rays.m_origin[2][i] };
+		float direction[3] = { rays.m_direction[0][i], rays.m_direction[1][i], rays.m_direction[2][i] };
+		m_keys[i] = rayKey(origin, direction, bounds.min(), scale);
+	}
+	radixSort(m_keys, order, m_sortScratch);
+}
+
+// Reorders the ray queue of the next bounce so that rays starting close to each other in the same direction octant
+// are traced one after the other and go through the same BVH nodes
+void WavefrontRenderer::sortRays()
+{
+	double start = omp_get_wtime();
+	int count = int(m_rays.m_path.size());
+	m_order.resize(count);
+	for (int i = 0; i < count; i++) m_order[i] = i;
+	sortOrder(m_rays, m_order);
+	m_nextRays.resize(count);
+	#pragma omp parallel for
+	for (int r = 0; r < count; r++)
+	{
+		int i = m_order[r];
+		for (int c = 0; c < 3; c++)
+		{
+			m_nextRays.m_origin[c][r] = m_rays.m_origin[c][i];
+			m_nextRays.m_direction[c][r] = m_rays.m_direction[c][i];
+		}
+		m_nextRays.m_tMax[r] = m_rays.m_tMax[i];
+		m_nextRays.m_path[r] = m_rays.m_path[i];
+	}
+	std::swap(m_rays, m_nextRays);
+	// Counted with the tracing of these rays
+	m_bounceTime += omp_get_wtime() - start;
+}
+
+// Adds the samples of each pixel of the wave to the image, in sample order
+void WavefrontRenderer::accumulate(Image& image, int firstPixel, int pixelCount)
+{
+	int firstPath = m_pathOffsets[firstPixel];
+	#pragma omp parallel for
+	for (int p = firstPixel; p < firstPixel + pixelCount; p++)
+	{
+		int pixel = m_pixels[p];
+		Vec3f totalColorResponse(0, 0, 0);
+		double luminanceSquares = 0.0;
+		for (int path = m_pathOffsets[p] - firstPath; path < m_pathOffsets[p + 1] - firstPath; path++)
+		{
+			Vec3f sampleColor = m_paths.radiance(path);
+			totalColorResponse += sampleColor;
+			double luminance = Image::luminance(sampleColor);
+			luminanceSquares += luminance * luminance;
+		}
+		image.accumulate(pixel % m_width, pixel / m_width, totalColorResponse, luminanceSquares, uint32_t(m_pathOffsets[p + 1] - m_pathOffsets[p]));
+	}
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <vector>
+#include "rayTracer.h"
+
+/// <summary>
+/// Wavefront path tracer : instead of following each path to its end, a batch of paths advances one bounce
+/// at a time through a sequence of kernels (camera rays, intersection, emissive shading, light sampling,
+/// shadow rays, scattering). Each kernel runs over a whole queue, so every thread executes the same code on a
+/// stream of rays. Queues are structures of arrays and are compacted between kernels, paths that end are
+/// dropped from the next bounce. The image is the same as the one of RayTracer::pathTrace, including the multiple importance
+/// sampling of the lights and of the BSDF.
+/// Optionally, the incoherent rays of the bounces are sorted by origin and direction before being traced.
+/// </summary>
+class WavefrontRenderer
+{
+	public:
+		WavefrontRenderer(const Scene& scene, const RenderParams& params, const Sampler& sampler);
+
+		// Same contract as RayTracer::renderPass
+		void renderPass(Image& image, size_t sampleCount, const std::vector<uint32_t>* pixelSamples);
+
+	private:
+		struct RayQueue
+		{
+			std::vector<float> m_origin[3];
+			std::vector<float> m_direction[3];
+			std::vector<float> m_tMax;
+			std::vector<int> m_path;
+			void resize(size_t size);
+			inline Ray ray(int i) const { return Ray(Vec3f(m_origin[0][i], m_origin[1][i], m_origin[2][i]), Vec3f(m_direction[0][i], m_direction[1][i], m_direction[2][i]), 0.f, m_tMax[i]); }
+			void set(int i, const Ray& ray, int path);
+		};
+
+		// Per path state, indexed by path
+		struct PathStates
+		{
+			std::vector<int> m_pixel;
+			std::vector<int> m_sampleIndex;
+			std::vector<int> m_dimension;
+			std::vector<float> m_throughput[3];
+			std::vector<float> m_radiance[3];
+			// Last scattering vertex and density of the direction sampled there, for the MIS weight of the lights found by the next ray
+			std::vector<float> m_previousPosition[3];
+			std::vector<float> m_previousNormal[3];
+			std::vector<float> m_bsdfPdf;
+			void resize(size_t size);
+			inline Vec3f throughput(int i) const { return Vec3f(m_throughput[0][i], m_throughput[1][i], m_throughput[2][i]); }
+			inline Vec3f radiance(int i) const { return Vec3f(m_radiance[0][i], m_radiance[1][i], m_radiance[2][i]); }
+		};
+
+		// Closest hits, indexed like the ray queue
+		struct HitQueue
+		{
+			std::vector<float> m_position[3];
+			std::vector<float> m_normal[3];
+			std::vector<int> m_mesh;                          // -1 for a miss
+			std::vector<int> m_triangle;                      // index in the mesh indices
+			void resize(size_t size);
+		};
+
+		// Next event estimation, lightSlots() consecutive entries per shaded hit
+		struct ShadowQueue
+		{
+			RayQueue m_rays;
+			std::vector<float> m_contribution[3];
+			std::vector<uint8_t> m_valid;                     // a ray was generated and isn't occluded
+			void resize(size_t size);
+		};
+
+		void generateCameraRays(const Image& image, int firstPixel, int pixelCount);
+		void intersect(size_t depth);
+		void sortByMaterial();
+		void shadeEmissive(size_t depth);
+		void sampleLights();
+		void traceShadowRays(size_t depth);
+		void addDirectLighting();
+		void scatter(size_t depth);
+		void sortRays();
+		void sortOrder(const RayQueue& rays, std::vector<int>& order);
+		void accumulate(Image& image, int firstPixel, int pixelCount);
+		inline int lightSlots() const { return m_scene.lightSampler().empty() ? 0 : int(RayTracer::kEmissiveSamples); }
+
+		const Scene& m_scene;
+		const RenderParams& m_params;
+		const Sampler& m_sampler;
+		int m_width;
+		int m_height;
+		std::vector<int> m_pixels;                            // pixels rendered by the pass, y * width + x
+		std::vector<int> m_pathOffsets;                       // first path of each of these pixels in the pass, plus the total
+		PathStates m_paths;
+		RayQueue m_rays;
+		RayQueue m_nextRays;
+		HitQueue m_hits;
+		std::vector<int> m_emissiveQueue;                     // ray queue indices of the hits on each kind of material
+		std::vector<int> m_surfaceQueue;
+		ShadowQueue m_shadows;
+		std::vector<float> m_roulette;                        // russian roulette sample of each scattered hit
+		std::vector<uint32_t> m_keys;
+		std::vector<int> m_order;
+		std::vector<int> m_sortScratch;
+		// Rays traced and time spent tracing after the camera hits, for the rays/s report of the pass
+		double m_bounceRays = 0, m_bounceTime = 0;
+		double m_shadowRays = 0, m_shadowTime = 0;
+};